@@ -1,7 +1,11 @@
 #include "adc.h"
 #include "adc_cal.h"
+#include "adc_filter.h"
+#include "../clock/clock.h"
+#include "../power/power.h"
 #include <avr/interrupt.h>
 #include <stddef.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include "../uart/uart.h"
@@ -9,20 +13,69 @@
 #define ADC_10_BITS 10U
 #define ADC_8_BITS  8U
 
-#define SAMPLE_HOLD_CAPACITY             14e-12f
-#define SAMPLE_HOLD_DISCHARGE_TIME(load) (5 * SAMPLE_HOLD_CAPACITY * load)
+#define ADC_N_CHANNELS 8U
+#define ADC_MUX_MSK    (1 << MUX3 | 1 << MUX2 | 1 << MUX1 | 1 << MUX0)
+#define ADC_REFS_MSK   (1 << REFS1 | 1 << REFS0)
+
+#define SAMPLE_HOLD_CAPACITY_PF             14U
+#define SAMPLE_HOLD_DISCHARGE_TIME_US(load) ((5UL * SAMPLE_HOLD_CAPACITY_PF * (load) + 999) / 1000)    // 5 tau [pF * kohm = ns]
+
+#define ADC_CONVERSION_CLK_CYCLES 13U
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+#define ADC_F_CPU clock_get_f_cpu_hz()
+#else
+#define ADC_F_CPU F_CPU
+#endif
 
 /* ------------------------ Calibration coefficients ------------------------ */
 static uint16_t vref_internal_mV  = 1100;
 static uint16_t vref_avcc_mv      = 5000;
 static int16_t vref_drift_avcc_mV = 0;
+
+// Temperature sensor, typical values from the datasheet (24.8): 242mV @ -45C, 380mV @ 85C
+static uint16_t temp_raw[2] = {(242UL * 1024 * ADC_TEMP_N_SAMPLES) / 1100, (380UL * 1024 * ADC_TEMP_N_SAMPLES) / 1100};
+static int16_t temp_cC[2]   = {-4500, 8500};
+
+// Per channel two-point correction: raw * gain / 2^ADC_GAIN_SHIFT + offset (offset in 10 bit codes)
+static uint16_t channel_gain[ADC_N_CHANNELS]     = {[0 ... ADC_N_CHANNELS - 1] = ADC_GAIN_UNITY};
+static int16_t channel_offset[ADC_N_CHANNELS]    = {0};
+static uint8_t channel_reference[ADC_N_CHANNELS] = {0};    // Reference of the fit, the only one it is valid for
+static uint8_t channel_corrected                 = 0;      // Bitmask of channels with a valid correction
 /* -------------------------------------------------------------------------- */
 
+static struct {
+    int16_t value_cC;
+    uint32_t timestamp_ms;
+    uint16_t cache_ms;
+    bool is_valid;
+} adc_temp = {0};
+
+typedef struct {
+    ADC_AWD_init_t limits;    // Requested limits in mV (kept to recompute raw codes)
+    uint16_t low_raw;
+    uint16_t high_raw;
+    uint16_t low_release_raw;     // low_raw + hysteresis
+    uint16_t high_release_raw;    // high_raw - hysteresis
+    uint8_t setting;              // Reference and resolution (REFS | ADLAR) of the raw limits
+    ADC_AWD_zone_t zone;
+} ADC_AWD_t;
+
 struct adc_handle {
     bool is_avaliable;
     ADC_init_t config;
     ADC_state_t state;
     ADC_reference_t last_reference;
+    volatile uint8_t settle_conversions;    // Dummy conversions left before the real one (IT mode)
+    ADC_AWD_t awd[ADC_N_CHANNELS];
+    uint8_t awd_enabled;            // Bitmask of watched channels
+    volatile uint8_t awd_events;    // Bitmask of channels that changed zone
+    ADC_EOC_callback_t eoc_callback;
+    void *eoc_ctx;
+    ADC_AWD_callback_t awd_callback;
+    void *awd_ctx;
+    ADC_scan_callback_t scan_callback;
+    void *scan_ctx;
 };
 
 typedef enum {
@@ -32,13 +85,49 @@ typedef enum {
     ADC_IT_START_READ_VOLTAGE,
     ADC_IT_START_READ_HIGH_IMPEDANCE,
     ADC_IT_START_READ_HIGH_IMPEDANCE_VOLTAGE,
-    ADC_IT_START_READ_VCC_VOLTAGE,
+    ADC_IT_START_READ_PROFILE_VOLTAGE,
+    ADC_IT_SCAN,
 } ADC_IT_last_call_t;
 
+struct adc_profile {
+    uint8_t admux;    // Precomputed REFS | ADLAR | MUX image
+    uint8_t channel;
+    ADC_reference_t reference;
+    ADC_resolution_t bits;
+    uint8_t settle_conversions;
+};
+
+static ADC_profile_t adc_profiles[ADC_MAX_PROFILES];
+static uint8_t adc_n_profiles = 0;
+
+#define ADC_VBG_SETTLE_US 70U    // Bandgap start-up time, 70 us max (datasheet: internal voltage reference)
+static ADC_profile_t adc_vcc_profile;    // CH_VBG against AVCC, compiled by ADC_init (not from the pool)
+static void ADC_profile_compile(ADC_handle_t *hadc, ADC_profile_t *profile, ADC_profile_init_t *cfg);
+
+static struct {
+    ADC_profile_t *profiles[ADC_MAX_PROFILES];    // Grouped by reference
+    uint8_t index[ADC_MAX_PROFILES];              // Position in the array given by the user
+    uint8_t n_profiles;
+    uint8_t position;
+    bool is_reversed;    // Scan starts from the group that matches the current reference
+} adc_scan;
+
 static ADC_IT_last_call_t ADC_IT_last_state = ADC_IT_IDLE;
 
+static void ADC_no_EOC_callback(ADC_handle_t *hadc, uint16_t value, void *ctx) {
+}
+
+static void ADC_no_AWD_callback(ADC_handle_t *hadc, ADC_channel_t channel, ADC_AWD_zone_t zone, void *ctx) {
+}
+
+static void ADC_no_scan_callback(ADC_handle_t *hadc, uint8_t index, uint16_t value_mV, void *ctx) {
+}
+
 static ADC_handle_t adc_handle = {
     .is_avaliable     = true,
+    .eoc_callback     = ADC_no_EOC_callback,
+    .awd_callback     = ADC_no_AWD_callback,
+    .scan_callback    = ADC_no_scan_callback,
     .state            = ADC_STOPED,
     .last_reference   = ADC_AREF,    // P.O.R value: Datasheet 23.9.1 ADMUX – ADC Multiplexer Selection Register
     .config.reference = ADC_AREF,    // P.O.R value: Datasheet 23.9.1 ADMUX – ADC Multiplexer Selection Register
@@ -52,27 +141,48 @@ uint16_t ADC_get_value(ADC_resolution_t resolution) {
 }
 
 ADC_reference_t ADC_get_reference(ADC_handle_t *hadc) {
-    return (ADC_reference_t)(ADMUX & (1 << REFS1 | 1 << REFS0));
+    return (ADC_reference_t)(ADMUX & ADC_REFS_MSK);
 }
 
 static inline __attribute__((always_inline)) uint16_t ADC_get_steps(ADC_handle_t *hadc) {
     return 1 << (ADC_10_BITS - (hadc->config.bits / ADC_8B_RESOLUTION) * (ADC_10_BITS - ADC_8_BITS));
 }
 
-static inline __attribute__((always_inline)) uint16_t ADC_get_voltage_mV(ADC_handle_t *hadc) {
+// Applied to every channel conversion (polling, IT, profiles, scans) before filters and watchdogs
+static inline __attribute__((always_inline)) uint16_t ADC_channel_correct(ADC_handle_t *hadc, uint8_t channel, uint16_t raw) {
+    if (channel >= ADC_N_CHANNELS || !(channel_corrected & (1 << channel))) return raw;
+    if (channel_reference[channel] != hadc->config.reference) return raw;
+
+    int16_t offset = channel_offset[channel];
+    if (hadc->config.bits == ADC_8B_RESOLUTION) offset >>= (ADC_10_BITS - ADC_8_BITS);
+
+    int32_t value = (int32_t)((((uint32_t)raw * channel_gain[channel]) + (1UL << (ADC_GAIN_SHIFT - 1))) >> ADC_GAIN_SHIFT) + offset;
+    if (value < 0) return 0;
+    if (value >= ADC_get_steps(hadc)) return ADC_get_steps(hadc) - 1;
+    return (uint16_t)value;
+}
+
+uint16_t ADC_get_full_scale(ADC_handle_t *hadc) {
+    return ADC_get_steps(hadc);
+}
+
+uint16_t ADC_raw_to_mV(ADC_handle_t *hadc, uint16_t raw) {
     if (hadc->config.reference == ADC_INTERNAL_1_1) {
-        return ((uint32_t)vref_internal_mV * ADC_get_value(hadc->config.bits)) / ADC_get_steps(hadc);
+        return ((uint32_t)vref_internal_mV * raw) / ADC_get_steps(hadc);
     } else if (hadc->config.reference == ADC_AVCC) {
-        return (((uint32_t)vref_avcc_mv * ADC_get_value(hadc->config.bits)) / ADC_get_steps(hadc));
+        return (((uint32_t)vref_avcc_mv * raw) / ADC_get_steps(hadc));
     }
     return 0;
 }
 
 /* --------------------------------- Setters -------------------------------- */
+static void ADC_AWD_update_thresholds(ADC_handle_t *hadc);
+
 static inline __attribute__((always_inline)) void ADC_set_resolution(ADC_handle_t *hadc, ADC_resolution_t res) {
     if (hadc->config.bits == res) return;
     hadc->config.bits = res;
-    ADMUX |= res;
+    ADMUX             = (ADMUX & ~(1 << ADLAR)) | res;
+    ADC_AWD_update_thresholds(hadc);
 }
 
 static inline __attribute__((always_inline)) void ADC_set_prescaler(ADC_handle_t *hadc, ADC_preescaler_t preescaler) {
@@ -89,12 +199,13 @@ static inline __attribute__((always_inline)) void ADC_set_low_power_channels(ADC
     DIDR0 |= lp_channels;
 }
 
-inline __attribute__((always_inline)) void ADC_set_reference(ADC_handle_t *hadc, ADC_reference_t reference) {
+void ADC_set_reference(ADC_handle_t *hadc, ADC_reference_t reference) {
     if (hadc->last_reference == reference && hadc->config.reference == reference) return;
     hadc->last_reference   = hadc->config.reference;
     hadc->config.reference = reference;
-    ADMUX &= ~(1 << REFS1 | 1 << REFS0);
+    ADMUX &= ~ADC_REFS_MSK;
     ADMUX |= reference;
+    ADC_AWD_update_thresholds(hadc);
 }
 
 static inline __attribute__((always_inline)) void ADC_set_trigger(ADC_handle_t *hadc, ADC_trigger_t trigger_source) {
@@ -109,8 +220,8 @@ static inline __attribute__((always_inline)) void ADC_set_trigger(ADC_handle_t *
 }
 
 static inline __attribute__((always_inline)) void ADC_set_channel(ADC_channel_t ch) {
-    if ((ADMUX & (1 << MUX3 | 1 << MUX2 | 1 << MUX1 | 1 << MUX0)) == ch) return;
-    ADMUX &= ~(1 << MUX3 | 1 << MUX2 | 1 << MUX1 | 1 << MUX0);
+    if ((ADMUX & ADC_MUX_MSK) == ch) return;
+    ADMUX &= ~ADC_MUX_MSK;
     ADMUX |= ch;
 }
 
@@ -118,6 +229,7 @@ static inline __attribute__((always_inline)) void ADC_set_channel(ADC_channel_t
 static ADC_handle_t *ADC_register_handle(void) {
     if (adc_handle.is_avaliable) {
         adc_handle.is_avaliable = false;
+        PWR_acquire(PWR_ADC);
         return &adc_handle;
     }
     return NULL;
@@ -126,6 +238,13 @@ static ADC_handle_t *ADC_register_handle(void) {
 static void ADC_unregister_handle(ADC_handle_t *hadc) {
     if (!adc_handle.is_avaliable) {
         adc_handle.is_avaliable = true;
+        adc_handle.eoc_callback  = ADC_no_EOC_callback;    // The next owner starts without them
+        adc_handle.eoc_ctx       = NULL;
+        adc_handle.awd_callback  = ADC_no_AWD_callback;
+        adc_handle.awd_ctx       = NULL;
+        adc_handle.scan_callback = ADC_no_scan_callback;
+        adc_handle.scan_ctx      = NULL;
+        PWR_release(PWR_ADC);    // ADEN already cleared: the ADC must be off before its clock stops
     }
 }
 
@@ -139,18 +258,195 @@ static inline __attribute__((always_inline)) void ADC_disable(ADC_handle_t *hadc
     hadc->state = ADC_STOPED;
 }
 
+static uint16_t ADC_get_conversion_time_us(ADC_handle_t *hadc) {
+    uint8_t adps    = hadc->config.preescaler & (1 << ADPS2 | 1 << ADPS1 | 1 << ADPS0);
+    uint8_t div     = adps == 0 ? 2 : 1 << adps;
+    uint32_t cycles = (uint32_t)ADC_CONVERSION_CLK_CYCLES * div;
+    uint32_t f_cpu  = ADC_F_CPU;
+    return (cycles * 1000000UL + f_cpu - 1) / f_cpu;
+}
+
 static inline __attribute__((always_inline)) void ADC_delay(uint16_t delay_us) {
-    for (uint16_t i = 0; i < (F_CPU / 1000000) * delay_us; i++) {
+    uint32_t n_loops = (ADC_F_CPU / 1000UL) * delay_us / 1000UL;
+    for (uint32_t i = 0; i < n_loops; i++) {
         __asm__ __volatile__("nop");
     }
 }
 
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+// The ADC prescaler moves by the same power of two as the CPU clock, so the ADC clock (and the
+// conversion times) stay the same. A change DIV2..DIV128 can not follow is refused, it would
+// take the ADC clock out of its range. A conversion running across the change finishes at the
+// new ADC clock.
+static bool ADC_clock_notifier(CLK_event_t event, clk_prescaler_t from, clk_prescaler_t to, void *ctx) {
+    if (adc_handle.is_avaliable) return true;
+
+    uint8_t adps = adc_handle.config.preescaler & (1 << ADPS2 | 1 << ADPS1 | 1 << ADPS0);
+    int8_t shift = (int8_t)(adps == 0 ? 1 : adps) - ((int8_t)to - (int8_t)from);
+    if (event == CLK_PRE_CHANGE) return shift >= 1 && shift <= 7;
+
+    ADC_set_prescaler(&adc_handle, (ADC_preescaler_t)shift);    // ADPS2:0 is log2 of the division
+    return true;
+}
+#endif
+
+/* ----------------------------- Analog watchdog ---------------------------- */
+#define ADC_AWD_NO_SETTING 0xFF    // Never a REFS | ADLAR image: forces the next update
+
+// Hysteresis below half the window, so the release points never cross the opposite limit
+static inline __attribute__((always_inline)) uint16_t ADC_AWD_max_hysteresis(uint16_t low, uint16_t high, uint16_t hysteresis) {
+    uint16_t span = high - low;
+    if ((uint32_t)hysteresis * 2 < span) return hysteresis;
+    return span ? (span - 1) / 2 : 0;
+}
+
+static uint16_t ADC_mV_to_raw(uint8_t setting, uint16_t mV) {
+    uint16_t vref_mV = (setting & ADC_REFS_MSK) == ADC_INTERNAL_1_1 ? vref_internal_mV : vref_avcc_mv;
+    uint16_t steps   = (setting & ADC_8B_RESOLUTION) ? 1U << ADC_8_BITS : 1U << ADC_10_BITS;
+    uint32_t raw     = ((uint32_t)mV * steps + vref_mV / 2) / vref_mV;
+    return raw >= steps ? steps - 1U : (uint16_t)raw;
+}
+
+static void ADC_AWD_update_channel(ADC_handle_t *hadc, uint8_t ch, uint8_t setting) {
+    ADC_AWD_t *awd = &hadc->awd[ch];
+    if (awd->setting == setting) return;
+
+    uint16_t low_raw        = ADC_mV_to_raw(setting, awd->limits.low_mV);
+    uint16_t high_raw       = ADC_mV_to_raw(setting, awd->limits.high_mV);
+    uint16_t hysteresis_raw = ADC_AWD_max_hysteresis(low_raw, high_raw, ADC_mV_to_raw(setting, awd->limits.hysteresis_mV));    // Again, after rounding
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        awd->low_raw          = low_raw;
+        awd->high_raw         = high_raw;
+        awd->low_release_raw  = low_raw + hysteresis_raw;
+        awd->high_release_raw = high_raw - hysteresis_raw;
+        awd->setting          = setting;
+    }
+}
+
+static inline __attribute__((always_inline)) uint8_t ADC_AWD_setting(ADC_handle_t *hadc) {
+    return hadc->config.reference | hadc->config.bits;
+}
+
+// Task context only (setters, profiles, scan start): the ISR just compares
+static void ADC_AWD_update_thresholds(ADC_handle_t *hadc) {
+    for (uint8_t ch = 0; ch < ADC_N_CHANNELS; ch++) {
+        if (hadc->awd_enabled & (1 << ch)) ADC_AWD_update_channel(hadc, ch, ADC_AWD_setting(hadc));
+    }
+}
+
+static inline __attribute__((always_inline)) void ADC_AWD_update_profile(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    if (profile->channel < ADC_N_CHANNELS && (hadc->awd_enabled & (1 << profile->channel))) {
+        ADC_AWD_update_channel(hadc, profile->channel, profile->admux & (ADC_REFS_MSK | ADC_8B_RESOLUTION));
+    }
+}
+
+// Returns true if the sample belongs to a watched channel (and therefore was consumed)
+static inline __attribute__((always_inline)) bool ADC_AWD_evaluate(ADC_handle_t *hadc, uint8_t ch, uint16_t raw) {
+    if (ch >= ADC_N_CHANNELS || !(hadc->awd_enabled & (1 << ch))) return false;
+
+    ADC_AWD_t *awd = &hadc->awd[ch];
+    if (awd->setting != ADC_AWD_setting(hadc)) return false;    // Limits converted for another reference or resolution
+
+    ADC_AWD_zone_t zone = awd->zone;
+
+    switch (zone) {
+    case ADC_AWD_INSIDE:
+        if (raw > awd->high_raw) zone = ADC_AWD_ABOVE_HIGH;
+        else if (raw < awd->low_raw) zone = ADC_AWD_BELOW_LOW;
+        break;
+    case ADC_AWD_ABOVE_HIGH:
+        if (raw < awd->low_raw) zone = ADC_AWD_BELOW_LOW;
+        else if (raw < awd->high_release_raw) zone = ADC_AWD_INSIDE;
+        break;
+    case ADC_AWD_BELOW_LOW:
+        if (raw > awd->high_raw) zone = ADC_AWD_ABOVE_HIGH;
+        else if (raw > awd->low_release_raw) zone = ADC_AWD_INSIDE;
+        break;
+    }
+
+    if (zone != awd->zone) {
+        awd->zone = zone;
+        hadc->awd_events |= (1 << ch);
+        hadc->awd_callback(hadc, (ADC_channel_t)ch, zone, hadc->awd_ctx);
+    }
+    return true;
+}
+
+void ADC_AWD_config(ADC_handle_t *hadc, ADC_channel_t channel, ADC_AWD_init_t *cfg) {
+    if (channel >= ADC_N_CHANNELS || cfg->low_mV > cfg->high_mV) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->awd_enabled &= ~(1 << channel);    // Not evaluated by the ISR while being updated
+    }
+    hadc->awd[channel].limits               = *cfg;
+    hadc->awd[channel].limits.hysteresis_mV = ADC_AWD_max_hysteresis(cfg->low_mV, cfg->high_mV, cfg->hysteresis_mV);
+    hadc->awd[channel].zone                 = ADC_AWD_INSIDE;
+    hadc->awd[channel].setting              = ADC_AWD_NO_SETTING;
+    ADC_AWD_update_channel(hadc, channel, ADC_AWD_setting(hadc));
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->awd_events &= ~(1 << channel);
+        hadc->awd_enabled |= (1 << channel);
+    }
+}
+
+void ADC_AWD_disable(ADC_handle_t *hadc, ADC_channel_t channel) {
+    if (channel >= ADC_N_CHANNELS) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->awd_enabled &= ~(1 << channel);
+    }
+}
+
+ADC_AWD_zone_t ADC_AWD_get_zone(ADC_handle_t *hadc, ADC_channel_t channel) {
+    if (channel >= ADC_N_CHANNELS) return ADC_AWD_INSIDE;
+    return hadc->awd[channel].zone;
+}
+
+uint8_t ADC_AWD_get_events(ADC_handle_t *hadc) {
+    uint8_t events;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        events           = hadc->awd_events;
+        hadc->awd_events = 0;
+    }
+    return events;
+}
+/* -------------------------------------------------------------------------- */
+
 uint16_t ADC_read_VCC_mV(ADC_handle_t *hadc) {
-    ADC_set_reference(hadc, ADC_AVCC);
-    ADC_read(hadc, CH_VBG);    // Dummy read
-    uint16_t vcc = ((uint32_t)vref_internal_mV * ADC_get_steps(hadc) / ADC_read(hadc, CH_VBG)) + vref_drift_avcc_mV;
-    ADC_set_reference(hadc, hadc->last_reference);
-    return vcc;
+    return ADC_read_profile_mV(hadc, &adc_vcc_profile);
+}
+
+uint16_t ADC_read_temperature_raw(ADC_handle_t *hadc) {
+    ADC_reference_t last_ref   = hadc->config.reference;
+    ADC_resolution_t last_bits = hadc->config.bits;
+    uint16_t sum               = 0;
+
+    ADC_set_resolution(hadc, ADC_10B_RESOLUTION);
+    ADC_set_reference(hadc, ADC_INTERNAL_1_1);
+    ADC_read(hadc, CH_TEMP);    // Dummy read
+    for (uint8_t i = 0; i < ADC_TEMP_N_SAMPLES; i++) {
+        sum += ADC_read(hadc, CH_TEMP);
+    }
+    ADC_set_reference(hadc, last_ref);
+    ADC_set_resolution(hadc, last_bits);
+    return sum;
+}
+
+int16_t ADC_read_temperature_cC(ADC_handle_t *hadc, uint32_t now_ms) {
+    if (adc_temp.is_valid && (now_ms - adc_temp.timestamp_ms) < adc_temp.cache_ms) return adc_temp.value_cC;
+
+    int32_t raw = ADC_read_temperature_raw(hadc);
+
+    adc_temp.value_cC     = temp_cC[0] + (raw - temp_raw[0]) * (temp_cC[1] - temp_cC[0]) / ((int32_t)temp_raw[1] - temp_raw[0]);
+    adc_temp.timestamp_ms = now_ms;
+    adc_temp.is_valid     = true;
+    return adc_temp.value_cC;
+}
+
+void ADC_set_temperature_cache_ms(uint16_t cache_ms) {
+    adc_temp.cache_ms = cache_ms;
+    adc_temp.is_valid = false;
 }
 
 void ADC_set_calibration(ADC_handle_t *hadc, void *calibration) {
@@ -162,6 +458,33 @@ void ADC_set_calibration(ADC_handle_t *hadc, void *calibration) {
         vref_avcc_mv       = ADC_get_calibrated_avcc_ref_mV((ADC_calibration_t *)calibration);
         vref_drift_avcc_mV = ADC_get_calibrated_avcc_ref_drift_mV((ADC_calibration_t *)calibration);
     }
+    if (ADC_temp_is_calibrated()) {
+        uint16_t raw_0 = ADC_get_calibrated_temp_raw((ADC_calibration_t *)calibration, 0);
+        uint16_t raw_1 = ADC_get_calibrated_temp_raw((ADC_calibration_t *)calibration, 1);
+        if (raw_0 != raw_1) {
+            temp_raw[0]       = raw_0;
+            temp_raw[1]       = raw_1;
+            temp_cC[0]        = ADC_get_calibrated_temp_cC((ADC_calibration_t *)calibration, 0);
+            temp_cC[1]        = ADC_get_calibrated_temp_cC((ADC_calibration_t *)calibration, 1);
+            adc_temp.is_valid = false;
+        }
+    }
+    for (uint8_t channel = 0; channel < ADC_N_CHANNELS; channel++) {
+        bool is_calibrated = ADC_channel_is_calibrated((ADC_channel_t)channel);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            channel_corrected &= ~(1 << channel);    // Channels no longer in the record are read raw
+            if (is_calibrated) {
+                channel_gain[channel]      = ADC_get_calibrated_channel_gain((ADC_calibration_t *)calibration, (ADC_channel_t)channel);
+                channel_offset[channel]    = ADC_get_calibrated_channel_offset((ADC_calibration_t *)calibration, (ADC_channel_t)channel);
+                channel_reference[channel] = ADC_get_calibrated_channel_reference((ADC_calibration_t *)calibration, (ADC_channel_t)channel);
+                channel_corrected |= (1 << channel);
+            }
+        }
+    }
+    for (uint8_t ch = 0; ch < ADC_N_CHANNELS; ch++) {
+        hadc->awd[ch].setting = ADC_AWD_NO_SETTING;    // Same setting, new references: convert again
+    }
+    ADC_AWD_update_thresholds(hadc);
     hadc->state = ADC_IDLE;
 }
 
@@ -174,11 +497,20 @@ ADC_handle_t *ADC_init(ADC_init_t *cfg) {
     ADC_handle_t *hadc = ADC_register_handle();
     if (hadc == NULL) return NULL;
 
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    static bool is_notifier_registered = false;
+    if (!is_notifier_registered) is_notifier_registered = clock_register_notifier(ADC_clock_notifier, NULL);
+#endif
     ADC_set_resolution(hadc, cfg->bits);
     ADC_set_prescaler(hadc, cfg->preescaler);
     ADC_set_low_power_channels(hadc, cfg->low_power_channels);
     ADC_set_reference(hadc, cfg->reference);
     ADC_set_trigger(hadc, cfg->trigger_source);
+
+    ADC_profile_init_t vcc_cfg = {.channel = CH_VBG, .reference = ADC_AVCC, .bits = cfg->bits, .settle_us = ADC_VBG_SETTLE_US};
+    ADC_profile_compile(hadc, &adc_vcc_profile, &vcc_cfg);
+
+    if (ADC_CAL_load()) ADC_set_calibration(hadc, ADC_get_calibration());    // Nominal references otherwise
     ADC_enable(hadc);
     return hadc;
 }
@@ -188,7 +520,7 @@ void ADC_deinit(ADC_handle_t *hadc) {
     ADC_unregister_handle(hadc);
 }
 
-static uint16_t ADC_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t delay_us) {
+static uint16_t ADC_convert(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t delay_us) {
     ADC_set_channel(channel);
     ADC_delay(delay_us);
 
@@ -200,20 +532,27 @@ static uint16_t ADC_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_
     return ADC_get_value(hadc->config.bits);
 }
 
+static inline __attribute__((always_inline)) uint16_t ADC_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t delay_us) {
+    return ADC_channel_correct(hadc, channel, ADC_convert(hadc, channel, delay_us));
+}
+
 uint16_t ADC_high_impedance_read(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t load_kohms) {
-    return ADC_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME(load_kohms));
+    return ADC_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME_US(load_kohms));
 }
 uint16_t ADC_high_impedance_read_mV(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t load_kohms) {
-    ADC_high_impedance_read(hadc, channel, load_kohms);
-    return ADC_get_voltage_mV(hadc);
+    return ADC_raw_to_mV(hadc, ADC_high_impedance_read(hadc, channel, load_kohms));
 }
 
 uint16_t ADC_read(ADC_handle_t *hadc, ADC_channel_t channel) {
     return ADC_read_base(hadc, channel, 10);    // NOTE - Maybe a small delay is needed (aprox 10us)
 }
 uint16_t ADC_read_mV(ADC_handle_t *hadc, ADC_channel_t channel) {
-    ADC_read(hadc, channel);
-    return ADC_get_voltage_mV(hadc);
+    return ADC_raw_to_mV(hadc, ADC_read(hadc, channel));
+}
+
+// Register value without the per channel correction, used to measure the calibration points
+uint16_t ADC_read_uncorrected(ADC_handle_t *hadc, ADC_channel_t channel) {
+    return ADC_convert(hadc, channel, 10);
 }
 
 /* -------------------- Public functions : Interrupt mode -------------------- */
@@ -224,23 +563,30 @@ ADC_handle_t *ADC_IT_init(ADC_init_t *cfg) {
     return hadc;
 }
 
-void ADC_IT_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t delay_us) {
+// The settling time is not waited here: it is covered by discarded conversions
+// chained from the ISR, so the caller (usually another ISR) never blocks.
+void ADC_IT_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t settle_us) {
     if (hadc->state == ADC_BUSY) return;
 
     hadc->state = ADC_BUSY;
     ADC_set_channel(channel);
-    ADC_delay(delay_us);
+
+    hadc->settle_conversions = 0;
+    if (settle_us) {
+        uint16_t conversion_us   = ADC_get_conversion_time_us(hadc);
+        hadc->settle_conversions = (settle_us + conversion_us - 1) / conversion_us;
+    }
 
     ADCSRA |= (1 << ADSC);
 }
 
 void ADC_IT_high_impedance_read(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t load_kohms) {
     ADC_IT_last_state = ADC_IT_START_READ_HIGH_IMPEDANCE;
-    ADC_IT_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME(load_kohms));
+    ADC_IT_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME_US(load_kohms));
 }
 void ADC_IT_high_impedance_read_mV(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t load_kohms) {
     ADC_IT_last_state = ADC_IT_START_READ_HIGH_IMPEDANCE_VOLTAGE;
-    ADC_IT_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME(load_kohms));
+    ADC_IT_read_base(hadc, channel, SAMPLE_HOLD_DISCHARGE_TIME_US(load_kohms));
 }
 
 void ADC_IT_read(ADC_handle_t *hadc, ADC_channel_t channel) {
@@ -253,33 +599,192 @@ void ADC_IT_read_mV(ADC_handle_t *hadc, ADC_channel_t channel) {
 }
 
 void ADC_IT_read_VCC_mV(ADC_handle_t *hadc) {
-    ADC_IT_last_state = ADC_IT_START_READ_VCC_VOLTAGE;
-    ADC_set_reference(hadc, ADC_AVCC);
-    ADC_IT_read_base(hadc, CH_VBG, 10);
+    ADC_IT_read_profile_mV(hadc, &adc_vcc_profile);
+}
+
+/* ---------------------------- Channel profiles ---------------------------- */
+static inline __attribute__((always_inline)) uint16_t ADC_profile_to_mV(ADC_handle_t *hadc, ADC_profile_t *profile, uint16_t raw) {
+    if (profile->channel == CH_VBG) {
+        if (raw == 0) return 0;
+        return ((uint32_t)vref_internal_mV * ADC_get_steps(hadc) / raw) + vref_drift_avcc_mV;
+    }
+    return ADC_raw_to_mV(hadc, raw);
+}
+
+// Single ADMUX store, returns the number of conversions to discard before the sample
+static inline __attribute__((always_inline)) uint8_t ADC_profile_select(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    uint8_t settle = profile->settle_conversions;
+    if ((ADMUX ^ profile->admux) & ADC_REFS_MSK) settle++;    // New reference needs to settle on AREF
+
+    ADMUX                  = profile->admux;
+    hadc->last_reference   = hadc->config.reference;
+    hadc->config.reference = profile->reference;
+    hadc->config.bits      = profile->bits;
+    return settle;
+}
+
+static inline __attribute__((always_inline)) void ADC_IT_profile_start(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    hadc->state              = ADC_BUSY;
+    hadc->settle_conversions = ADC_profile_select(hadc, profile);
+    ADCSRA |= (1 << ADSC);
+}
+
+static void ADC_profile_compile(ADC_handle_t *hadc, ADC_profile_t *profile, ADC_profile_init_t *cfg) {
+    profile->channel   = cfg->channel & ADC_MUX_MSK;
+    profile->reference = cfg->reference;
+    profile->bits      = cfg->bits;
+    profile->admux     = cfg->reference | cfg->bits | profile->channel;
+
+    profile->settle_conversions = 0;
+    if (cfg->settle_us) {
+        uint16_t conversion_us      = ADC_get_conversion_time_us(hadc);
+        profile->settle_conversions = (cfg->settle_us + conversion_us - 1) / conversion_us;
+    }
+
+    if (profile->channel < ADC_N_CHANNELS) {
+        ADC_filter_config(profile->channel, &cfg->filter);
+    }
+}
+
+ADC_profile_t *ADC_profile_init(ADC_handle_t *hadc, ADC_profile_init_t *cfg) {
+    if (adc_n_profiles >= ADC_MAX_PROFILES) return NULL;
+    ADC_profile_t *profile = &adc_profiles[adc_n_profiles++];
+    ADC_profile_compile(hadc, profile, cfg);
+    return profile;
+}
+
+uint16_t ADC_read_profile(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    ADC_AWD_update_profile(hadc, profile);
+    uint8_t conversions = ADC_profile_select(hadc, profile) + 1;
+
+    hadc->state = ADC_BUSY;
+    while (conversions--) {
+        ADCSRA |= (1 << ADSC);
+        while (ADCSRA & (1 << ADSC));
+    }
+    hadc->state = ADC_IDLE;
+    return ADC_channel_correct(hadc, profile->channel, ADC_get_value(hadc->config.bits));
+}
+
+uint16_t ADC_read_profile_mV(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    return ADC_profile_to_mV(hadc, profile, ADC_read_profile(hadc, profile));
+}
+
+static ADC_profile_t *adc_it_profile = NULL;
+
+void ADC_IT_read_profile_mV(ADC_handle_t *hadc, ADC_profile_t *profile) {
+    if (hadc->state == ADC_BUSY) return;
+    ADC_AWD_update_profile(hadc, profile);
+    adc_it_profile    = profile;
+    ADC_IT_last_state = ADC_IT_START_READ_PROFILE_VOLTAGE;
+    ADC_IT_profile_start(hadc, profile);
+}
+
+bool ADC_scan_config(ADC_handle_t *hadc, ADC_profile_t **profiles, uint8_t n_profiles) {
+    if (hadc->state == ADC_BUSY && ADC_IT_last_state == ADC_IT_SCAN) return false;    // ADC_vect indexes adc_scan
+    if (n_profiles > ADC_MAX_PROFILES) n_profiles = ADC_MAX_PROFILES;
+    for (uint8_t i = 0; i < n_profiles; i++) {
+        if (profiles[i] == NULL) return false;    // e.g. a failed ADC_profile_init, the previous scan is kept
+    }
+
+    // Stable insertion sort by reference: each reference is selected once per scan
+    for (uint8_t i = 0; i < n_profiles; i++) {
+        uint8_t j = i;
+        while (j > 0 && adc_scan.profiles[j - 1]->reference > profiles[i]->reference) {
+            adc_scan.profiles[j] = adc_scan.profiles[j - 1];
+            adc_scan.index[j]    = adc_scan.index[j - 1];
+            j--;
+        }
+        adc_scan.profiles[j] = profiles[i];
+        adc_scan.index[j]    = i;
+    }
+    adc_scan.n_profiles = n_profiles;
+    return true;
+}
+
+static inline __attribute__((always_inline)) uint8_t ADC_scan_slot(void) {
+    return adc_scan.is_reversed ? adc_scan.n_profiles - 1 - adc_scan.position : adc_scan.position;
+}
+
+void ADC_IT_scan_start(ADC_handle_t *hadc) {
+    if (hadc->state == ADC_BUSY || adc_scan.n_profiles == 0) return;
+    for (uint8_t i = 0; i < adc_scan.n_profiles; i++) {    // A channel in several profiles is watched with the last one
+        ADC_AWD_update_profile(hadc, adc_scan.profiles[i]);
+    }
+
+    // Walk the groups starting from the one already selected in ADMUX
+    adc_scan.is_reversed = adc_scan.profiles[0]->reference != ADC_get_reference(hadc) &&
+                           adc_scan.profiles[adc_scan.n_profiles - 1]->reference == ADC_get_reference(hadc);
+    adc_scan.position    = 0;
+    ADC_IT_last_state    = ADC_IT_SCAN;
+    ADC_IT_profile_start(hadc, adc_scan.profiles[ADC_scan_slot()]);
+}
+/* -------------------------------------------------------------------------- */
+
+void ADC_register_EOC_callback(ADC_handle_t *hadc, ADC_EOC_callback_t callback, void *ctx) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->eoc_callback = (callback != NULL) ? callback : ADC_no_EOC_callback;
+        hadc->eoc_ctx      = ctx;
+    }
+}
+
+void ADC_register_AWD_callback(ADC_handle_t *hadc, ADC_AWD_callback_t callback, void *ctx) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->awd_callback = (callback != NULL) ? callback : ADC_no_AWD_callback;
+        hadc->awd_ctx      = ctx;
+    }
+}
+
+void ADC_register_scan_callback(ADC_handle_t *hadc, ADC_scan_callback_t callback, void *ctx) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        hadc->scan_callback = (callback != NULL) ? callback : ADC_no_scan_callback;
+        hadc->scan_ctx      = ctx;
+    }
+}
+
+static inline __attribute__((always_inline)) void ADC_EOC_dispatch(ADC_handle_t *hadc, uint16_t value) {
+    hadc->eoc_callback(hadc, value, hadc->eoc_ctx);
 }
 
 ISR(ADC_vect) {
+    if (adc_handle.settle_conversions) {    // Settling conversion: discard and chain the next one
+        adc_handle.settle_conversions--;
+        ADCSRA |= (1 << ADSC);
+        return;
+    }
+
     if (adc_handle.state == ADC_BUSY) {
         adc_handle.state = ADC_EOC;
     }
 
+    uint8_t channel = ADMUX & ADC_MUX_MSK;
+    uint16_t value  = ADC_filter_update(channel, ADC_channel_correct(&adc_handle, channel, ADC_get_value(adc_handle.config.bits)));
+    bool is_watched = ADC_AWD_evaluate(&adc_handle, channel, value);
+
     switch (ADC_IT_last_state) {
     case ADC_IT_START_READ:
-        ADC_EOC_callback(&adc_handle, ADC_get_value(adc_handle.config.bits));
+        if (!is_watched) ADC_EOC_dispatch(&adc_handle, value);
         break;
     case ADC_IT_START_READ_VOLTAGE:
-        ADC_EOC_callback(&adc_handle, ADC_get_voltage_mV(&adc_handle));
+        if (!is_watched) ADC_EOC_dispatch(&adc_handle, ADC_raw_to_mV(&adc_handle, value));
         break;
     case ADC_IT_START_READ_HIGH_IMPEDANCE:
-        ADC_EOC_callback(&adc_handle, ADC_get_value(adc_handle.config.bits));
+        if (!is_watched) ADC_EOC_dispatch(&adc_handle, value);
         break;
     case ADC_IT_START_READ_HIGH_IMPEDANCE_VOLTAGE:
-        ADC_EOC_callback(&adc_handle, ADC_get_voltage_mV(&adc_handle));
+        if (!is_watched) ADC_EOC_dispatch(&adc_handle, ADC_raw_to_mV(&adc_handle, value));
         break;
-    case ADC_IT_START_READ_VCC_VOLTAGE:
-        ADC_EOC_callback(&adc_handle, ((uint32_t)vref_internal_mV * ADC_get_steps(&adc_handle) / ADC_get_value(adc_handle.config.bits)) + vref_drift_avcc_mV);
-        ADC_set_reference(&adc_handle, adc_handle.last_reference);
+    case ADC_IT_START_READ_PROFILE_VOLTAGE:
+        if (!is_watched) ADC_EOC_dispatch(&adc_handle, ADC_profile_to_mV(&adc_handle, adc_it_profile, value));
         break;
+    case ADC_IT_SCAN: {
+        ADC_profile_t *profile = adc_scan.profiles[ADC_scan_slot()];
+        if (!is_watched) adc_handle.scan_callback(&adc_handle, adc_scan.index[ADC_scan_slot()], ADC_profile_to_mV(&adc_handle, profile, value), adc_handle.scan_ctx);
+        if (++adc_scan.position < adc_scan.n_profiles) {
+            ADC_IT_profile_start(&adc_handle, adc_scan.profiles[ADC_scan_slot()]);    // Keeps ADC_BUSY
+        }
+        break;
+    }
     default:
         ADC_IT_last_state = ADC_IT_IDLE;
         break;
@@ -16,6 +16,7 @@
 #define ADC_H
 
 #include "../../board.h"
+#include "adc_filter.h"
 #include <avr/io.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -90,6 +91,33 @@ typedef struct {
     ADC_trigger_t trigger_source;
 } ADC_init_t;
 
+typedef enum {
+    ADC_AWD_INSIDE,        // low_mV <= value <= high_mV
+    ADC_AWD_ABOVE_HIGH,    // value > high_mV (until it drops below high_mV - hysteresis_mV)
+    ADC_AWD_BELOW_LOW,     // value < low_mV (until it rises above low_mV + hysteresis_mV)
+} ADC_AWD_zone_t;
+
+typedef struct {
+    uint16_t low_mV;
+    uint16_t high_mV;
+    uint16_t hysteresis_mV;
+} ADC_AWD_init_t;
+
+#ifndef ADC_MAX_PROFILES
+#define ADC_MAX_PROFILES 8
+#endif
+
+struct adc_profile;
+typedef struct adc_profile ADC_profile_t;
+
+typedef struct {
+    uint8_t channel;    // ADC_channel_t or ADC_alt_channel_t (CH_VBG reads VCC in mV)
+    ADC_reference_t reference;
+    ADC_resolution_t bits;
+    uint16_t settle_us;    // Covered by discarded conversions before the sample
+    ADC_filter_init_t filter;
+} ADC_profile_init_t;
+
 typedef enum {
     ADC_STOPED,
     ADC_IDLE,
@@ -119,10 +147,63 @@ void ADC_IT_high_impedance_read(ADC_handle_t *hadc, ADC_channel_t channel, uint8
 void ADC_IT_high_impedance_read_mV(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t load_kohms);
 
 /* ---------------------------------- Utils --------------------------------- */
+#define ADC_TEMP_N_SAMPLES 16U    // Oversampling of the temperature sensor (raw value is the sum)
+
+#define ADC_GAIN_SHIFT 14U                        // Per channel gain is Q2.14
+#define ADC_GAIN_UNITY (1U << ADC_GAIN_SHIFT)
+
+uint16_t ADC_read_uncorrected(ADC_handle_t *hadc, ADC_channel_t channel);    // Skips the per channel gain/offset
+
+uint16_t ADC_raw_to_mV(ADC_handle_t *hadc, uint16_t raw);
+uint16_t ADC_get_full_scale(ADC_handle_t *hadc);    // 1024 or 256 steps
+
+// Read through a CH_VBG profile against AVCC: like any profile read, AVCC stays selected
 uint16_t ADC_read_VCC_mV(ADC_handle_t *hadc);
 void ADC_IT_read_VCC_mV(ADC_handle_t *hadc);
 
+// Internal temperature sensor (1.1V reference). Result in centi-degrees Celsius.
+// A value younger than cache_ms (ADC_set_temperature_cache_ms) is returned without converting.
+uint16_t ADC_read_temperature_raw(ADC_handle_t *hadc);
+int16_t ADC_read_temperature_cC(ADC_handle_t *hadc, uint32_t now_ms);
+void ADC_set_temperature_cache_ms(uint16_t cache_ms);
+
 ADC_state_t ADC_get_state(ADC_handle_t *hadc);
 
-extern void ADC_EOC_callback(ADC_handle_t *hadc, uint16_t value);
+/* ---------------------------- Channel profiles ---------------------------- */
+// A profile is compiled once into the ADMUX image of its channel/reference/resolution,
+// selecting it later is a single ADMUX store. A reference change adds one settling conversion.
+ADC_profile_t *ADC_profile_init(ADC_handle_t *hadc, ADC_profile_init_t *cfg);
+
+uint16_t ADC_read_profile(ADC_handle_t *hadc, ADC_profile_t *profile);
+uint16_t ADC_read_profile_mV(ADC_handle_t *hadc, ADC_profile_t *profile);
+void ADC_IT_read_profile_mV(ADC_handle_t *hadc, ADC_profile_t *profile);
+
+// Scan: profiles are grouped by reference once, the scan callback reports each result
+// with its index in the array passed to ADC_scan_config. Returns false while a scan is running
+// or when an entry is NULL.
+bool ADC_scan_config(ADC_handle_t *hadc, ADC_profile_t **profiles, uint8_t n_profiles);
+void ADC_IT_scan_start(ADC_handle_t *hadc);
+
+typedef void (*ADC_scan_callback_t)(ADC_handle_t *hadc, uint8_t index, uint16_t value_mV, void *ctx);
+void ADC_register_scan_callback(ADC_handle_t *hadc, ADC_scan_callback_t callback, void *ctx);    // NULL unregisters
+
+/* ----------------------------- Analog watchdog ---------------------------- */
+// Limits are converted to raw codes with the current reference, resolution and calibration, and
+// converted again by the setters, the profile reads and ADC_IT_scan_start, never in the ISR.
+// A sample taken with another reference or resolution is not evaluated. The hysteresis is
+// clamped below half the window.
+// The window is evaluated on the filtered value when the channel has a filter (adc_filter.h).
+// Samples of a watched channel are consumed by the ISR: the EOC callback is not
+// called for them, only the AWD callback when the channel changes zone.
+void ADC_AWD_config(ADC_handle_t *hadc, ADC_channel_t channel, ADC_AWD_init_t *cfg);
+void ADC_AWD_disable(ADC_handle_t *hadc, ADC_channel_t channel);
+ADC_AWD_zone_t ADC_AWD_get_zone(ADC_handle_t *hadc, ADC_channel_t channel);
+uint8_t ADC_AWD_get_events(ADC_handle_t *hadc);    // Bitmask of channels that changed zone (cleared on read)
+
+typedef void (*ADC_AWD_callback_t)(ADC_handle_t *hadc, ADC_channel_t channel, ADC_AWD_zone_t zone, void *ctx);
+void ADC_register_AWD_callback(ADC_handle_t *hadc, ADC_AWD_callback_t callback, void *ctx);    // NULL unregisters
+
+// End of conversion of the ADC_IT_read_x functions, called from the ISR with the registered ctx
+typedef void (*ADC_EOC_callback_t)(ADC_handle_t *hadc, uint16_t value, void *ctx);
+void ADC_register_EOC_callback(ADC_handle_t *hadc, ADC_EOC_callback_t callback, void *ctx);    // NULL unregisters
 #endif
\ No newline at end of file
@@ -13,46 +13,95 @@
  */
 #include "adc_cal.h"
 #include "../../board.h"
+#include "../eeprom/eeprom.h"
+#include "../uart/uart.h"
 #include <avr/eeprom.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #define ADC_AVCC_N_SAMPLES 100
 
-EEMEM uint16_t eeprom_internal_ref_mv        = 0;
-EEMEM bool eeprom_internal_ref_is_calibrated = 0;
+#define ADC_CAL_SETTLE_READS     8U    // Discarded after a reference/channel switch (AREF capacitor)
+#define ADC_CAL_INT_REF_MIN_MV   1000U
+#define ADC_CAL_INT_REF_MAX_MV   1200U
+#define ADC_CAL_AVCC_REF_MIN_MV  2700U
+#define ADC_CAL_AVCC_REF_MAX_MV  5500U
+#define ADC_CAL_CHANNEL_SAMPLES  64U
+#define ADC_CAL_CHANNELS         8U
 
-EEMEM uint16_t eeprom_avcc_ref_mv        = 0;
-EEMEM int16_t eeprom_avcc_ref_drift_mv   = 0;
-EEMEM bool eeprom_avcc_ref_is_calibrated = 0;
+#define ADC_CAL_RECORD_VERSION 3U
+
+#define ADC_CAL_FLAG_INT_REF  (1 << 0)
+#define ADC_CAL_FLAG_AVCC_REF (1 << 1)
+#define ADC_CAL_FLAG_TEMP_0   (1 << 2)
+#define ADC_CAL_FLAG_TEMP_1   (1 << 3)
+#define ADC_CAL_FLAG_TEMP     (ADC_CAL_FLAG_TEMP_0 | ADC_CAL_FLAG_TEMP_1)
 
 struct ADC_calibration {
     uint16_t int_ref;
     uint16_t avcc_ref;
     int16_t avcc_drift;
+    uint16_t temp_raw[2];
+    int16_t temp_cC[2];
+    uint8_t channels;    // Bitmask of channels with a valid gain/offset
+    uint16_t channel_gain[ADC_CAL_CHANNELS];
+    int16_t channel_offset[ADC_CAL_CHANNELS];
+    uint8_t channel_reference[ADC_CAL_CHANNELS];    // ADC_reference_t of the fit
 };
 
+typedef struct {
+    uint8_t version;
+    uint8_t flags;    // ADC_CAL_FLAG_x: which values of the record are valid
+    ADC_calibration_t values;
+} ADC_CAL_record_t;
+
+// Wear leveled: every save goes to the next slot, the CRC is kept by the EEPROM ring
+#define ADC_CAL_EEPROM_SLOTS 4U
+EEMEM uint8_t eeprom_calibration[ADC_CAL_EEPROM_SLOTS * EEPROM_RING_SLOT_SIZE(sizeof(ADC_CAL_record_t))];
+_Static_assert(sizeof(ADC_CAL_record_t) <= EEPROM_MAX_RECORD_SIZE, "ADC calibration record does not fit EEPROM_MAX_RECORD_SIZE");
+
+static ADC_CAL_record_t calibration_record = {0};    // RAM copy, every query is served from here
+static EEPROM_ring_t *calibration_ring     = NULL;
+static bool calibration_is_loaded          = false;
+
+// One block read, once. No valid slot or an old record falls back to "not calibrated"
+bool ADC_CAL_load(void) {
+    if (calibration_is_loaded) return calibration_record.flags || calibration_record.values.channels;
+
+    EEPROM_ring_init_t ring_cfg = {
+        .base        = (uint16_t)(uintptr_t)eeprom_calibration,
+        .n_slots     = ADC_CAL_EEPROM_SLOTS,
+        .record_size = sizeof(ADC_CAL_record_t),
+    };
+    calibration_ring = EEPROM_ring_init(&ring_cfg);
+
+    if (!calibration_ring || !EEPROM_ring_read(calibration_ring, &calibration_record) ||
+        calibration_record.version != ADC_CAL_RECORD_VERSION) {
+        calibration_record         = (ADC_CAL_record_t){0};
+        calibration_record.version = ADC_CAL_RECORD_VERSION;
+    }
+    calibration_is_loaded = true;
+    return calibration_record.flags || calibration_record.values.channels;
+}
+
+// Non-blocking: the record is committed in background by the EEPROM driver. False when it
+// could not be queued (no ring, or the job queue is full)
+static bool ADC_CAL_save(void) {
+    return calibration_ring && EEPROM_ring_write(calibration_ring, &calibration_record);
+}
+
 bool ADC_is_calibrated(void) {
-    return ADC_internal_ref_is_calibrated() && ADC_avcc_ref_is_calibrated();
+    return (calibration_record.flags & (ADC_CAL_FLAG_INT_REF | ADC_CAL_FLAG_AVCC_REF)) == (ADC_CAL_FLAG_INT_REF | ADC_CAL_FLAG_AVCC_REF);
 }
 
 ADC_calibration_t *ADC_get_calibration(void) {
-    static ADC_calibration_t calibration;
-    eeprom_busy_wait();
-    eeprom_read_block(&calibration.int_ref, &eeprom_internal_ref_mv, sizeof(uint16_t));
-    eeprom_busy_wait();
-    eeprom_read_block(&calibration.avcc_ref, &eeprom_avcc_ref_mv, sizeof(uint16_t));
-    eeprom_busy_wait();
-    eeprom_read_block(&calibration.avcc_drift, &eeprom_avcc_ref_drift_mv, sizeof(int16_t));
-    return &calibration;
+    return &calibration_record.values;
 }
 
 bool ADC_internal_ref_is_calibrated(void) {
-    bool is_calibrated;
-    eeprom_busy_wait();
-    eeprom_read_block(&is_calibrated, &eeprom_internal_ref_is_calibrated, sizeof(bool));
-    return is_calibrated;
+    return calibration_record.flags & ADC_CAL_FLAG_INT_REF;
 }
 
 uint16_t ADC_get_calibrated_internal_ref_mV(ADC_calibration_t *calibration) {
@@ -60,10 +109,7 @@ uint16_t ADC_get_calibrated_internal_ref_mV(ADC_calibration_t *calibration) {
 }
 
 bool ADC_avcc_ref_is_calibrated(void) {
-    bool is_calibrated;
-    eeprom_busy_wait();
-    eeprom_read_block(&is_calibrated, &eeprom_avcc_ref_is_calibrated, sizeof(bool));
-    return is_calibrated;
+    return calibration_record.flags & ADC_CAL_FLAG_AVCC_REF;
 }
 
 int16_t ADC_get_calibrated_avcc_ref_drift_mV(ADC_calibration_t *calibration) {
@@ -74,6 +120,34 @@ uint16_t ADC_get_calibrated_avcc_ref_mV(ADC_calibration_t *calibration) {
     return calibration->avcc_ref;
 }
 
+bool ADC_temp_is_calibrated(void) {
+    return (calibration_record.flags & ADC_CAL_FLAG_TEMP) == ADC_CAL_FLAG_TEMP;
+}
+
+uint16_t ADC_get_calibrated_temp_raw(ADC_calibration_t *calibration, uint8_t point) {
+    return calibration->temp_raw[point & 1];
+}
+
+int16_t ADC_get_calibrated_temp_cC(ADC_calibration_t *calibration, uint8_t point) {
+    return calibration->temp_cC[point & 1];
+}
+
+bool ADC_channel_is_calibrated(ADC_channel_t channel) {
+    return channel < ADC_CAL_CHANNELS && (calibration_record.values.channels & (1 << channel));
+}
+
+uint16_t ADC_get_calibrated_channel_gain(ADC_calibration_t *calibration, ADC_channel_t channel) {
+    return calibration->channel_gain[channel % ADC_CAL_CHANNELS];
+}
+
+int16_t ADC_get_calibrated_channel_offset(ADC_calibration_t *calibration, ADC_channel_t channel) {
+    return calibration->channel_offset[channel % ADC_CAL_CHANNELS];
+}
+
+ADC_reference_t ADC_get_calibrated_channel_reference(ADC_calibration_t *calibration, ADC_channel_t channel) {
+    return (ADC_reference_t)calibration->channel_reference[channel % ADC_CAL_CHANNELS];
+}
+
 typedef struct {
     const char *message;
     uint8_t n_digits;
@@ -81,115 +155,240 @@ typedef struct {
     uint16_t high_limit;
 } ADC_CAL_parameters_t;
 
-static void strip_newline(char *buffer) {
-    while (*buffer != '\0') {
-        if (*buffer == '\n' || *buffer == '\r') {
-            *buffer = '\0';
-            break;
-        }
-        buffer++;
-    }
-}
-
-static uint16_t ADC_base_calibration(ADC_CAL_parameters_t *calibration) {
-    char buffer[8];
+// Line input from the UART without blocking: it waits only for the next received byte
+static PT_THREAD(ADC_CAL_input_pt(PT_t *pt, ADC_CAL_parameters_t *calibration, uint16_t *value)) {
+    static char buffer[8];
+    static uint8_t length;
     char *err_ptr;
-    uint16_t value;
-    uint8_t calibration_completed = 0;
+    uint16_t parsed;
 
-    while (!calibration_completed) {
+    PT_BEGIN(pt);
 
+    while (1) {
         printf("%s", calibration->message);
         fflush(stdout);
 
-        if (!fgets(buffer, sizeof(buffer), stdin)) {
-            printf("Input error. Please try again.\n");
-            continue;
+        length = 0;
+        while (1) {
+            PT_WAIT_UNTIL(pt, UART_is_available());
+            char received = getchar();
+            if (received == '\n' || received == '\r') {
+                if (length > 0) break;    // Empty lines (the \n of a \r\n) are skipped
+            } else if (length < sizeof(buffer) - 1) {
+                buffer[length++] = received;
+            }
         }
+        buffer[length] = '\0';
+        parsed         = (uint16_t)strtol(buffer, &err_ptr, 10U);
 
-        strip_newline(buffer);
-        value = (uint16_t)strtol(buffer, &err_ptr, 10U);
-
-        if (err_ptr == buffer ||                                                    // No se leyo nada
-            err_ptr - buffer != calibration->n_digits ||                            // No tiene n digitos
-            value < calibration->low_limit || value > calibration->high_limit) {    // Fuera de rango
+        if (err_ptr == buffer ||                                                      // No se leyo nada
+            err_ptr - buffer != calibration->n_digits ||                              // No tiene n digitos
+            parsed < calibration->low_limit || parsed > calibration->high_limit) {    // Fuera de rango
             printf("Invalid value. Please enter a number between %u and %u mV\n",
                    calibration->low_limit, calibration->high_limit);
-            continue;
         } else {
-            calibration_completed = 1;
+            *value = parsed;    // The record (in use by the driver, maybe being saved) only sees valid values
+            break;
         }
     }
 
-    printf("Calibration saved: %u mV\n", value);
-    return value;
+    printf("Calibration saved: %u mV\n", *value);
+    PT_END(pt);
 }
 
-void ADC_calibrate(ADC_handle_t *hadc) {
-    ADC_CAL_parameters_t cal_parameters = {0};
+// Interactive calibration context, kept across the waits (one calibration at a time)
+static struct {
+    PT_t input;
+    ADC_CAL_parameters_t parameters;
+    ADC_CAL_record_t *record;
+    ADC_reference_t last_ref;
+    uint32_t vcc;
+    uint8_t sample;
+} cal_ctx;
 
-    ADC_calibration_t values = {0};
-    ADC_reference_t last_ref = ADC_get_reference(hadc);
+PT_THREAD(ADC_calibrate_pt(PT_t *pt, ADC_handle_t *hadc)) {
+    PT_BEGIN(pt);
 
-    eeprom_busy_wait();
-    eeprom_update_byte(&eeprom_internal_ref_is_calibrated, 0);
+    cal_ctx.record   = &calibration_record;
+    cal_ctx.last_ref = ADC_get_reference(hadc);
 
-    eeprom_busy_wait();
-    eeprom_update_byte(&eeprom_avcc_ref_is_calibrated, 0);
+    cal_ctx.record->flags &= ~(ADC_CAL_FLAG_INT_REF | ADC_CAL_FLAG_AVCC_REF);
+    ADC_CAL_save();
 
     /* --------------------- Internal reference calibration --------------------- */
     ADC_set_reference(hadc, ADC_INTERNAL_1_1);
 
-    cal_parameters.message    = "Internal REF calibration in progress...\n"
-                                "Please connect a multimeter to the AREF pin\n"
-                                "Enter internal reference in [mV] (4 digits) (e.g. 1100 for 1.100 V): ";
-    cal_parameters.n_digits   = 4;
-    cal_parameters.low_limit  = 1000;
-    cal_parameters.high_limit = 1200;
+    cal_ctx.parameters.message    = "Internal REF calibration in progress...\n"
+                                    "Please connect a multimeter to the AREF pin\n"
+                                    "Enter internal reference in [mV] (4 digits) (e.g. 1100 for 1.100 V): ";
+    cal_ctx.parameters.n_digits   = 4;
+    cal_ctx.parameters.low_limit  = ADC_CAL_INT_REF_MIN_MV;
+    cal_ctx.parameters.high_limit = ADC_CAL_INT_REF_MAX_MV;
 
-    values.int_ref = ADC_base_calibration(&cal_parameters);
-    eeprom_busy_wait();
-    eeprom_update_word(&eeprom_internal_ref_mv, values.int_ref);
+    PT_SPAWN(pt, &cal_ctx.input, ADC_CAL_input_pt(&cal_ctx.input, &cal_ctx.parameters, &cal_ctx.record->values.int_ref));
+    cal_ctx.record->flags |= ADC_CAL_FLAG_INT_REF;
+    ADC_CAL_save();
 
-    eeprom_busy_wait();
-    eeprom_update_byte(&eeprom_internal_ref_is_calibrated, 1);
-
-    ADC_set_calibration(hadc, &values);
+    ADC_set_calibration(hadc, &cal_ctx.record->values);
 
     /* ----------------------- AVCC reference calibration ----------------------- */
     ADC_set_reference(hadc, ADC_AVCC);
 
-    cal_parameters.message    = "AVCC REF calibration in progress...\n"
-                                "Please connect a multimeter to the AREF pin\n"
-                                "An internal VCC measurement is performed by the device\n"
-                                "This value is used to calculate the drift from the AVCC reference\n"
-                                "Enter AVCC reference in [mV] (4 digits) (e.g. 5000 for 5.000 V): ";
-    cal_parameters.n_digits   = 4;
-    cal_parameters.low_limit  = 2700;
-    cal_parameters.high_limit = 5500;
-
-    values.avcc_ref = ADC_base_calibration(&cal_parameters);
-    uint32_t vcc    = 0;
-    for (uint8_t i = 0; i < ADC_AVCC_N_SAMPLES; i++) {
-        vcc += ADC_read_VCC_mV(hadc);
+    cal_ctx.parameters.message    = "AVCC REF calibration in progress...\n"
+                                    "Please connect a multimeter to the AREF pin\n"
+                                    "An internal VCC measurement is performed by the device\n"
+                                    "This value is used to calculate the drift from the AVCC reference\n"
+                                    "Enter AVCC reference in [mV] (4 digits) (e.g. 5000 for 5.000 V): ";
+    cal_ctx.parameters.n_digits   = 4;
+    cal_ctx.parameters.low_limit  = ADC_CAL_AVCC_REF_MIN_MV;
+    cal_ctx.parameters.high_limit = ADC_CAL_AVCC_REF_MAX_MV;
+
+    PT_SPAWN(pt, &cal_ctx.input, ADC_CAL_input_pt(&cal_ctx.input, &cal_ctx.parameters, &cal_ctx.record->values.avcc_ref));
+
+    cal_ctx.vcc = 0;
+    for (cal_ctx.sample = 0; cal_ctx.sample < ADC_AVCC_N_SAMPLES; cal_ctx.sample++) {
+        cal_ctx.vcc += ADC_read_VCC_mV(hadc);
+        PT_YIELD(pt);    // One conversion per turn
     }
-    vcc /= ADC_AVCC_N_SAMPLES;
-    printf("VCC measured: %u mV\n", vcc);
-    values.avcc_drift = (int16_t)((int16_t)values.avcc_ref - (int16_t)vcc);
-    printf("AVCC drift calibration saved: %d mV\n", values.avcc_drift);
+    cal_ctx.vcc /= ADC_AVCC_N_SAMPLES;
+    printf("VCC measured: %u mV\n", (uint16_t)cal_ctx.vcc);
+    cal_ctx.record->values.avcc_drift = (int16_t)((int16_t)cal_ctx.record->values.avcc_ref - (int16_t)cal_ctx.vcc);
+    printf("AVCC drift calibration saved: %d mV\n", cal_ctx.record->values.avcc_drift);
 
-    eeprom_busy_wait();
-    eeprom_update_word(&eeprom_avcc_ref_mv, values.avcc_ref);
+    cal_ctx.record->flags |= ADC_CAL_FLAG_AVCC_REF;
+    ADC_CAL_save();
 
-    eeprom_busy_wait();
-    eeprom_update_word(&eeprom_avcc_ref_drift_mv, values.avcc_drift);
+    ADC_set_calibration(hadc, &cal_ctx.record->values);
 
-    eeprom_busy_wait();
-    eeprom_update_byte(&eeprom_avcc_ref_is_calibrated, 1);
+    /* -------------------------------------------------------------------------- */
+    ADC_set_reference(hadc, cal_ctx.last_ref);
+    printf("Calibration completed\n");
 
-    ADC_set_calibration(hadc, &values);
+    PT_END(pt);
+}
+
+void ADC_calibrate(ADC_handle_t *hadc) {
+    PT_t pt;
+    PT_INIT(&pt);
+    while (PT_SCHEDULE(ADC_calibrate_pt(&pt, hadc)));
+}
+
+static uint16_t ADC_CAL_average(ADC_handle_t *hadc, uint8_t channel, uint16_t n_samples) {
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < ADC_CAL_SETTLE_READS; i++) {
+        ADC_read_uncorrected(hadc, (ADC_channel_t)channel);
+    }
+    for (uint16_t i = 0; i < n_samples; i++) {
+        sum += ADC_read_uncorrected(hadc, (ADC_channel_t)channel);
+    }
+    return (sum + n_samples / 2) / n_samples;
+}
+
+// Single point gain: AVCC is fitted from the external input, then the bandgap is measured
+// against the fitted AVCC. The VCC measurement (bandgap based) gives back that same AVCC, so
+// it can not provide an offset: the drift is cleared. cfg->channel must be an external input,
+// the bandgap against its own nominal value would only store the nominal values back.
+bool ADC_calibrate_auto(ADC_handle_t *hadc, ADC_CAL_auto_init_t *cfg) {
+    if (cfg->channel >= ADC_CAL_CHANNELS) return false;
+
+    uint16_t n_samples = cfg->n_samples;
+    if (n_samples == 0) n_samples = 1;
+    if (n_samples > ADC_CAL_AUTO_MAX_SAMPLES) n_samples = ADC_CAL_AUTO_MAX_SAMPLES;
+
+    ADC_CAL_record_t *record = &calibration_record;
+    ADC_calibration_t values = record->values;
+    ADC_reference_t last_ref = ADC_get_reference(hadc);
+    uint16_t steps           = ADC_get_full_scale(hadc);
+
+    /* ------------------------------- AVCC gain ------------------------------- */
+    ADC_set_reference(hadc, ADC_AVCC);
+    uint16_t raw = ADC_CAL_average(hadc, cfg->channel, n_samples);
+    if (raw == 0) {
+        ADC_set_reference(hadc, last_ref);
+        return false;
+    }
+    values.avcc_ref = ((uint32_t)cfg->reference_mV * steps + raw / 2) / raw;
+
+    /* -------------------------- Internal reference -------------------------- */
+    raw            = ADC_CAL_average(hadc, CH_VBG, n_samples);
+    values.int_ref = ((uint32_t)values.avcc_ref * raw + steps / 2) / steps;
+
+    if (values.int_ref < ADC_CAL_INT_REF_MIN_MV || values.int_ref > ADC_CAL_INT_REF_MAX_MV ||
+        values.avcc_ref < ADC_CAL_AVCC_REF_MIN_MV || values.avcc_ref > ADC_CAL_AVCC_REF_MAX_MV) {
+        ADC_set_reference(hadc, last_ref);
+        return false;
+    }
+
+    values.avcc_drift = 0;
+    record->values    = values;
+    record->flags |= ADC_CAL_FLAG_INT_REF | ADC_CAL_FLAG_AVCC_REF;
+    bool is_saved = ADC_CAL_save();
+    ADC_set_calibration(hadc, &record->values);
 
-    /* -------------------------------------------------------------------------- */
     ADC_set_reference(hadc, last_ref);
-    printf("Calibration completed\n");
-}
\ No newline at end of file
+    return is_saved;
+}
+
+bool ADC_calibrate_temperature(ADC_handle_t *hadc, uint8_t point, int16_t temp_cC) {
+    point &= 1;
+    ADC_CAL_record_t *record = &calibration_record;
+    uint16_t raw             = ADC_read_temperature_raw(hadc);
+
+    record->values.temp_raw[point] = raw;
+    record->values.temp_cC[point]  = temp_cC;
+    record->flags |= point ? ADC_CAL_FLAG_TEMP_1 : ADC_CAL_FLAG_TEMP_0;
+    bool is_saved = ADC_CAL_save();
+
+    printf("Temperature point %u %s: %d cC -> %u\n", point, is_saved ? "saved" : "not saved", temp_cC, raw);
+    ADC_set_calibration(hadc, &record->values);
+    return is_saved;
+}
+
+static struct {
+    uint8_t channel;
+    uint16_t raw;      // 10 bit codes
+    uint16_t ideal;    // Code expected for known_mV
+    bool is_valid;
+} channel_point = {0};
+
+// raw_0/raw_1 -> ideal_0/ideal_1: gain = d(ideal) / d(raw), offset = ideal_0 - gain * raw_0
+bool ADC_calibrate_channel(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t point, uint16_t known_mV) {
+    if (channel >= ADC_CAL_CHANNELS) return false;
+
+    uint16_t steps = ADC_get_full_scale(hadc);
+    uint16_t vref  = ADC_raw_to_mV(hadc, steps);
+    if (vref == 0) return false;    // AREF: unknown reference voltage
+
+    // Both points are kept in 10 bit codes so the fit does not depend on the resolution
+    uint16_t raw   = ADC_CAL_average(hadc, channel, ADC_CAL_CHANNEL_SAMPLES) * (1024U / steps);
+    uint16_t ideal = (uint16_t)(((uint32_t)known_mV * 1024U + vref / 2) / vref);
+
+    if ((point & 1) == 0) {
+        channel_point.channel  = channel;
+        channel_point.raw      = raw;
+        channel_point.ideal    = ideal;
+        channel_point.is_valid = true;
+        return true;
+    }
+
+    if (!channel_point.is_valid || channel_point.channel != channel || raw == channel_point.raw) return false;
+    channel_point.is_valid = false;
+
+    int32_t gain = (((int32_t)ideal - channel_point.ideal) * (int32_t)ADC_GAIN_UNITY) / ((int32_t)raw - channel_point.raw);
+    if (gain <= 0 || gain > UINT16_MAX) return false;
+
+    int32_t offset = (int32_t)channel_point.ideal -
+                     (int32_t)(((uint32_t)channel_point.raw * (uint32_t)gain + (ADC_GAIN_UNITY / 2)) >> ADC_GAIN_SHIFT);
+    if (offset < INT16_MIN || offset > INT16_MAX) return false;
+
+    ADC_CAL_record_t *record                  = &calibration_record;
+    record->values.channel_gain[channel]      = (uint16_t)gain;
+    record->values.channel_offset[channel]    = (int16_t)offset;
+    record->values.channel_reference[channel] = (uint8_t)ADC_get_reference(hadc);
+    record->values.channels |= (1 << channel);
+    bool is_saved = ADC_CAL_save();
+
+    printf("Channel %u calibrated: gain %u/%u offset %d\n", channel, (uint16_t)gain, ADC_GAIN_UNITY, (int16_t)offset);
+    ADC_set_calibration(hadc, &record->values);
+    return is_saved;
+}
@@ -15,13 +15,24 @@
 #ifndef ADC_CAL_H
 #define ADC_CAL_H
 
+#include "../../lib/pt/pt.h"
 #include "adc.h"
 #include <stdbool.h>
 #include <stdint.h>
 
+#define ADC_CAL_AUTO_MAX_SAMPLES 256U
+
 struct ADC_calibration;
 typedef struct ADC_calibration ADC_calibration_t;
 
+typedef struct {
+    uint8_t channel;          // CH0..CH7 wired to an external reference (not the bandgap itself)
+    uint16_t reference_mV;    // Voltage of that input
+    uint16_t n_samples;       // Averaged conversions per measurement (1..ADC_CAL_AUTO_MAX_SAMPLES)
+} ADC_CAL_auto_init_t;
+
+// Reads the newest valid record from EEPROM, once (ADC_init does it). False when there is none
+bool ADC_CAL_load(void);
 bool ADC_is_calibrated(void);
 
 bool ADC_internal_ref_is_calibrated(void);
@@ -31,7 +42,28 @@ bool ADC_avcc_ref_is_calibrated(void);
 int16_t ADC_get_calibrated_avcc_ref_drift_mV(ADC_calibration_t *calibration);
 uint16_t ADC_get_calibrated_avcc_ref_mV(ADC_calibration_t *calibration);
 
-void ADC_calibrate(ADC_handle_t *hadc);
+bool ADC_temp_is_calibrated(void);
+uint16_t ADC_get_calibrated_temp_raw(ADC_calibration_t *calibration, uint8_t point);
+int16_t ADC_get_calibrated_temp_cC(ADC_calibration_t *calibration, uint8_t point);
+
+bool ADC_channel_is_calibrated(ADC_channel_t channel);
+uint16_t ADC_get_calibrated_channel_gain(ADC_calibration_t *calibration, ADC_channel_t channel);    // Q2.14
+int16_t ADC_get_calibrated_channel_offset(ADC_calibration_t *calibration, ADC_channel_t channel);   // 10 bit codes
+ADC_reference_t ADC_get_calibrated_channel_reference(ADC_calibration_t *calibration, ADC_channel_t channel);
+
+void ADC_calibrate(ADC_handle_t *hadc);    // Interactive (UART), blocks until values are entered
+// Same interactive calibration as a protothread: it waits for each received byte and runs one
+// VCC conversion per turn, so it can be stepped from a task until PT_SCHEDULE() is false
+PT_THREAD(ADC_calibrate_pt(PT_t *pt, ADC_handle_t *hadc));
+// The calibrate functions below apply the new values right away and return false when the record
+// could not be queued for EEPROM: they are then lost at the next reset.
+bool ADC_calibrate_auto(ADC_handle_t *hadc, ADC_CAL_auto_init_t *cfg);    // Headless, bounded time, single point gain
+// Two-point temperature calibration: call once per point (0 and 1) with the device at a known temperature
+bool ADC_calibrate_temperature(ADC_handle_t *hadc, uint8_t point, int16_t temp_cC);
+// Two-point gain/offset of one channel, only applied while the reference selected when calling it is.
+// Call with point 0 and then point 1 while the input is held at a known voltage; the
+// coefficients are computed and stored on point 1. Returns false on a degenerate fit.
+bool ADC_calibrate_channel(ADC_handle_t *hadc, ADC_channel_t channel, uint8_t point, uint16_t known_mV);
 ADC_calibration_t *ADC_get_calibration(void);
 
 #endif    // ADC_CAL_H
\ No newline at end of file
@@ -0,0 +1,141 @@
+/**
+ * @file adc_filter.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-20
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+#include "adc_filter.h"
+#include <stddef.h>
+#include <util/atomic.h>
+
+#define ADC_FILTER_N_CHANNELS 8U
+
+typedef struct {
+    ADC_filter_type_t type;
+    bool is_primed;    // First sample seeds the state (no ramp from 0)
+    uint8_t iir_shift;
+    uint16_t output;
+    union {
+        struct {
+            uint16_t *window;    // Caller storage, 1 << size_shift samples
+            uint16_t sum;
+            uint8_t index;
+            uint8_t size_shift;
+        } ma;
+        struct {
+            uint16_t acc;    // y << iir_shift
+        } iir;
+        struct {
+            uint16_t window[3];
+            uint8_t index;
+        } median;
+    } state;
+} ADC_filter_t;
+
+static ADC_filter_t filters[ADC_FILTER_N_CHANNELS];
+
+static inline __attribute__((always_inline)) uint16_t ADC_filter_moving_average(ADC_filter_t *f, uint16_t raw) {
+    uint8_t size = 1 << f->state.ma.size_shift;
+    if (!f->is_primed) {
+        for (uint8_t i = 0; i < size; i++) f->state.ma.window[i] = raw;
+        f->state.ma.sum = (unsigned)raw << f->state.ma.size_shift;
+        return raw;
+    }
+    f->state.ma.sum += raw - f->state.ma.window[f->state.ma.index];
+    f->state.ma.window[f->state.ma.index] = raw;
+    f->state.ma.index                     = (f->state.ma.index + 1) & (size - 1);
+    return f->state.ma.sum >> f->state.ma.size_shift;
+}
+
+static inline __attribute__((always_inline)) uint16_t ADC_filter_iir(ADC_filter_t *f, uint16_t raw) {
+    if (!f->is_primed) {
+        f->state.iir.acc = raw << f->iir_shift;
+        return raw;
+    }
+    f->state.iir.acc += raw - (f->state.iir.acc >> f->iir_shift);
+    return f->state.iir.acc >> f->iir_shift;
+}
+
+static inline __attribute__((always_inline)) uint16_t ADC_filter_median_3(ADC_filter_t *f, uint16_t raw) {
+    if (!f->is_primed) {
+        f->state.median.window[0] = f->state.median.window[1] = f->state.median.window[2] = raw;
+        return raw;
+    }
+    f->state.median.window[f->state.median.index] = raw;
+    f->state.median.index                   = f->state.median.index == 2 ? 0 : f->state.median.index + 1;
+
+    uint16_t a = f->state.median.window[0], b = f->state.median.window[1], c = f->state.median.window[2];
+    if (a > b) {
+        uint16_t tmp = a;
+        a            = b;
+        b            = tmp;
+    }
+    // a <= b
+    if (c >= b) return b;
+    return c > a ? c : a;
+}
+
+uint16_t ADC_filter_update(uint8_t channel, uint16_t raw) {
+    if (channel >= ADC_FILTER_N_CHANNELS) return raw;
+    ADC_filter_t *f = &filters[channel];
+
+    switch (f->type) {
+    case ADC_FILTER_MOVING_AVERAGE: f->output = ADC_filter_moving_average(f, raw); break;
+    case ADC_FILTER_IIR: f->output = ADC_filter_iir(f, raw); break;
+    case ADC_FILTER_MEDIAN_3: f->output = ADC_filter_median_3(f, raw); break;
+    default: f->output = raw; break;
+    }
+    f->is_primed = true;
+    return f->output;
+}
+
+bool ADC_filter_config(uint8_t channel, ADC_filter_init_t *cfg) {
+    if (channel >= ADC_FILTER_N_CHANNELS) return false;
+    uint8_t shift = cfg->iir_shift;
+    if (shift == 0) shift = 1;
+    if (shift > ADC_FILTER_IIR_MAX_SHIFT) shift = ADC_FILTER_IIR_MAX_SHIFT;
+
+    ADC_filter_type_t type = cfg->type;
+    uint8_t size_shift     = 0;
+    if (type == ADC_FILTER_MOVING_AVERAGE) {
+        while (size_shift < 7 && (1 << size_shift) < cfg->window_size) size_shift++;
+        if (cfg->window == NULL || (1 << size_shift) != cfg->window_size || cfg->window_size < 2 ||
+            cfg->window_size > ADC_FILTER_MA_MAX_WINDOW) {
+            type = ADC_FILTER_NONE;
+        }
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        filters[channel]           = (ADC_filter_t){0};
+        filters[channel].type      = type;
+        filters[channel].iir_shift = shift;
+        if (type == ADC_FILTER_MOVING_AVERAGE) {
+            filters[channel].state.ma.window     = cfg->window;
+            filters[channel].state.ma.size_shift = size_shift;
+        }
+    }
+    return type == cfg->type;
+}
+
+void ADC_filter_reset(uint8_t channel) {
+    if (channel >= ADC_FILTER_N_CHANNELS) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        filters[channel].is_primed = false;
+    }
+}
+
+uint16_t ADC_filter_get_value(uint8_t channel) {
+    if (channel >= ADC_FILTER_N_CHANNELS) return 0;
+    uint16_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        value = filters[channel].output;
+    }
+    return value;
+}
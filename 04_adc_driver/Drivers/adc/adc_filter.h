@@ -0,0 +1,49 @@
+/**
+ * @file adc_filter.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-20
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef ADC_FILTER_H
+#define ADC_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADC_FILTER_MA_MAX_WINDOW 64    // 1023 * 64 still fits in 16 bits
+#define ADC_FILTER_IIR_MAX_SHIFT 6     // 1023 << 6 still fits in 16 bits
+
+typedef enum {
+    ADC_FILTER_NONE,
+    ADC_FILTER_MOVING_AVERAGE,    // y = sum(x[n-N+1..n]) / N
+    ADC_FILTER_IIR,               // y += (x - y) / 2^iir_shift
+    ADC_FILTER_MEDIAN_3,          // y = median(x[n-2], x[n-1], x[n])
+} ADC_filter_type_t;
+
+// The driver keeps a few bytes per channel, the moving average samples are stored by the caller
+// (e.g. static uint16_t ch0_window[8]) and must stay allocated while the filter is configured
+typedef struct {
+    ADC_filter_type_t type;
+    uint8_t iir_shift;       // Only used by ADC_FILTER_IIR (1..ADC_FILTER_IIR_MAX_SHIFT)
+    uint16_t *window;        // Only used by ADC_FILTER_MOVING_AVERAGE: window_size samples
+    uint8_t window_size;     // Power of 2, 2..ADC_FILTER_MA_MAX_WINDOW
+} ADC_filter_init_t;
+
+bool ADC_filter_config(uint8_t channel, ADC_filter_init_t *cfg);    // False (and no filter) on an invalid window
+void ADC_filter_reset(uint8_t channel);
+
+// Called from the ADC ISR with each raw sample, returns the filtered raw value
+uint16_t ADC_filter_update(uint8_t channel, uint16_t raw);
+
+// Last filtered raw value of the channel
+uint16_t ADC_filter_get_value(uint8_t channel);
+
+#endif    // ADC_FILTER_H
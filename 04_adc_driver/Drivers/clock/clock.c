@@ -16,15 +16,59 @@
 
 #ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
 
-#include <avr/interrupt.h>
 #include <avr/io.h>
+#include <stddef.h>
+#include <util/atomic.h>
 
-void clock_prescaler_config(clk_prescaler_t prescaler) {
-    cli();
-    CLKPR = (1 << CLKPCE);
-    CLKPR = prescaler;
+#define CLK_PRESCALER_MSK (1 << CLKPS3 | 1 << CLKPS2 | 1 << CLKPS1 | 1 << CLKPS0)
 
-    f_cpu_hz = F_CLK_HZ / (1 << prescaler);
+static struct {
+    CLK_notifier_t function;
+    void *ctx;
+} clk_notifiers[CLK_MAX_NOTIFIERS] = {{NULL}};
+static uint8_t clk_n_notifiers = 0;
+
+bool clock_register_notifier(CLK_notifier_t notifier, void *ctx) {
+    if (notifier == NULL || clk_n_notifiers >= CLK_MAX_NOTIFIERS) return false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        clk_notifiers[clk_n_notifiers].function = notifier;
+        clk_notifiers[clk_n_notifiers].ctx      = ctx;
+        clk_n_notifiers++;
+    }
+    return true;
+}
+
+bool clock_prescaler_config(clk_prescaler_t prescaler) {
+    if (prescaler > CLK_DIV_256) return false;
+
+    bool is_changed = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        clk_prescaler_t from = clock_get_prescaler();
+        if (from == prescaler) {
+            is_changed = true;
+        } else {
+            uint8_t i = 0;
+            while (i < clk_n_notifiers && clk_notifiers[i].function(CLK_PRE_CHANGE, from, prescaler, clk_notifiers[i].ctx)) i++;
+
+            if (i == clk_n_notifiers) {
+                CLKPR = (1 << CLKPCE);    // Timed sequence: CLKPS must be written within 4 cycles
+                CLKPR = prescaler;
+                for (i = 0; i < clk_n_notifiers; i++) {
+                    clk_notifiers[i].function(CLK_POST_CHANGE, from, prescaler, clk_notifiers[i].ctx);
+                }
+                is_changed = true;
+            }
+        }
+    }
+    return is_changed;
+}
+
+clk_prescaler_t clock_get_prescaler(void) {
+    return (clk_prescaler_t)(CLKPR & CLK_PRESCALER_MSK);
+}
+
+uint32_t clock_get_f_cpu_hz(void) {
+    return F_CLK_HZ >> clock_get_prescaler();
 }
 
-#endif
\ No newline at end of file
+#endif
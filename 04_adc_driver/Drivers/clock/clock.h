@@ -19,6 +19,9 @@
 
 #ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum {
     CLK_DIV_1   = 0b0000,
     CLK_DIV_2   = 0b0001,
@@ -31,15 +34,34 @@ typedef enum {
     CLK_DIV_256 = 0b1000
 } clk_prescaler_t;
 
+typedef enum {
+    CLK_PRE_CHANGE,     // Before CLKPR is written: returning false refuses the change
+    CLK_POST_CHANGE,    // Right after: the driver reprograms its timings for the new clock
+} CLK_event_t;
+
+// Drivers whose timings depend on the CPU clock (UART baud, ADC clock, timer prescalers, ...)
+// register one notifier. Both events run with the interrupts disabled, in registration order,
+// so no ISR ever sees a peripheral programmed for the other clock.
+typedef bool (*CLK_notifier_t)(CLK_event_t event, clk_prescaler_t from, clk_prescaler_t to, void *ctx);
+
+#ifndef CLK_MAX_NOTIFIERS
+#define CLK_MAX_NOTIFIERS 6
+#endif
+
+bool clock_register_notifier(CLK_notifier_t notifier, void *ctx);
+
 /**
  * @brief  Set dinamicaly the CPU clock prescaler
  * @param  prescaler: CLK_DIV_1 to CLK_DIV_256
  * @pre    The prescaler must be a valid clk_prescaler_t value
- * @post   The globals interrupts was disabled for safety reason and must be re-enabled if nedded
- * @post   The CPU clock (in Hz) will be F_CPU_HZ divided by the selected prescaler
- * @retval None
+ * @post   The global interrupt state is restored as it was before the call
+ * @post   The CPU clock (in Hz) will be F_CLK_HZ divided by the selected prescaler
+ * @retval false if a notifier refused the change (the clock is not changed)
  */
-void clock_prescaler_config(clk_prescaler_t prescaler);
+bool clock_prescaler_config(clk_prescaler_t prescaler);
+
+clk_prescaler_t clock_get_prescaler(void);    // Starts at CLK_DIV_8 with the CKDIV8 fuse
+uint32_t clock_get_f_cpu_hz(void);
 
 #endif
 
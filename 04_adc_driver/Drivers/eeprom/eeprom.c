@@ -0,0 +1,255 @@
+/**
+ * @file eeprom.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-22
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "eeprom.h"
+
+#include "../../board.h"
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#define EEPROM_SEQUENCE_SIZE 2U
+#define EEPROM_CRC_SIZE      2U
+
+struct EEPROM_ring {
+    bool is_available;
+    uint16_t base;
+    uint8_t n_slots;
+    uint8_t record_size;
+    uint8_t slot;          // Last queued slot
+    uint16_t sequence;     // Sequence of the last queued slot
+    uint8_t valid_slot;    // Newest slot completely written (or recovered at boot)
+    bool is_empty;
+    EEPROM_callback_t callback;
+    void *ctx;
+};
+
+typedef struct {
+    EEPROM_ring_t *ring;    // NULL for raw writes
+    const uint8_t *data;    // Raw writes only, framed jobs write their own frame
+    uint16_t address;
+    uint8_t length;    // Bytes to write (framed: sequence + record + CRC)
+    uint8_t position;
+    uint8_t slot;
+    uint8_t frame[EEPROM_RING_SLOT_SIZE(EEPROM_MAX_RECORD_SIZE)];
+} EEPROM_job_t;
+
+static void EEPROM_no_callback(EEPROM_ring_t *ring, void *ctx) {
+}
+
+static EEPROM_callback_t raw_callback = EEPROM_no_callback;
+static void *raw_ctx;
+
+static EEPROM_ring_t rings[EEPROM_MAX_RINGS] = {
+    [0 ... EEPROM_MAX_RINGS - 1] = {.is_available = true},
+};
+
+static EEPROM_job_t jobs[EEPROM_N_JOBS];
+static volatile uint8_t jobs_head  = 0;    // Job being written by the ISR
+static volatile uint8_t jobs_count = 0;
+
+/* ---------------------------------- Utils --------------------------------- */
+static inline __attribute__((always_inline)) uint16_t EEPROM_slot_address(EEPROM_ring_t *ring, uint8_t slot) {
+    return ring->base + (uint16_t)slot * EEPROM_RING_SLOT_SIZE(ring->record_size);
+}
+
+static bool EEPROM_slot_is_valid(EEPROM_ring_t *ring, uint8_t slot, uint16_t *sequence) {
+    uint16_t address = EEPROM_slot_address(ring, slot);
+    uint16_t crc     = 0xFFFF;
+
+    for (uint8_t i = 0; i < EEPROM_SEQUENCE_SIZE + ring->record_size; i++) {
+        crc = _crc16_update(crc, eeprom_read_byte((const uint8_t *)(uintptr_t)(address + i)));
+    }
+    *sequence = eeprom_read_word((const uint16_t *)(uintptr_t)address);
+    return eeprom_read_word((const uint16_t *)(uintptr_t)(address + EEPROM_SEQUENCE_SIZE + ring->record_size)) == crc;
+}
+
+static bool EEPROM_enqueue(EEPROM_job_t *job) {
+    bool is_queued = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (jobs_count < EEPROM_N_JOBS) {
+            jobs[(jobs_head + jobs_count) % EEPROM_N_JOBS] = *job;
+            jobs_count++;
+            EECR |= (1 << EERIE);
+            is_queued = true;
+        }
+    }
+    return is_queued;
+}
+
+// Sequence | snapshot of the record | CRC, all little endian: the CRC always matches the bytes
+// written, whatever the caller does with its record meanwhile
+static void EEPROM_frame_build(EEPROM_job_t *job, uint16_t sequence, const void *src) {
+    uint8_t payload_size = EEPROM_SEQUENCE_SIZE + job->ring->record_size;
+    uint16_t crc         = 0xFFFF;
+
+    job->frame[0] = sequence & 0xFF;
+    job->frame[1] = sequence >> 8;
+    memcpy(&job->frame[EEPROM_SEQUENCE_SIZE], src, job->ring->record_size);
+    for (uint8_t i = 0; i < payload_size; i++) {
+        crc = _crc16_update(crc, job->frame[i]);
+    }
+    job->frame[payload_size]     = crc & 0xFF;
+    job->frame[payload_size + 1] = crc >> 8;
+}
+
+static inline __attribute__((always_inline)) uint8_t EEPROM_job_byte(EEPROM_job_t *job) {
+    return job->ring ? job->frame[job->position] : job->data[job->position];
+}
+
+/* ------------------------------ Public functions ---------------------------- */
+EEPROM_ring_t *EEPROM_ring_init(EEPROM_ring_init_t *cfg) {
+    EEPROM_ring_t *ring = NULL;
+    for (uint8_t i = 0; i < EEPROM_MAX_RINGS; i++) {
+        if (rings[i].is_available) {
+            ring = &rings[i];
+            break;
+        }
+    }
+    if (ring == NULL || cfg->n_slots == 0 || cfg->record_size > EEPROM_MAX_RECORD_SIZE) return NULL;
+
+    ring->is_available = false;
+    ring->base         = cfg->base;
+    ring->n_slots      = cfg->n_slots;
+    ring->record_size  = cfg->record_size;
+    ring->is_empty     = true;
+    ring->callback     = EEPROM_no_callback;
+    ring->ctx          = NULL;
+
+    eeprom_busy_wait();
+    for (uint8_t slot = 0; slot < ring->n_slots; slot++) {
+        uint16_t sequence;
+        if (!EEPROM_slot_is_valid(ring, slot, &sequence)) continue;
+        if (ring->is_empty || (int16_t)(sequence - ring->sequence) > 0) {    // Wrap-around safe
+            ring->slot     = slot;
+            ring->sequence = sequence;
+            ring->is_empty = false;
+        }
+    }
+    if (ring->is_empty) {
+        ring->slot     = ring->n_slots - 1;    // First write goes to slot 0
+        ring->sequence = 0;
+    }
+    ring->valid_slot = ring->slot;
+    return ring;
+}
+
+bool EEPROM_ring_read(EEPROM_ring_t *ring, void *dst) {
+    if (ring->is_empty) return false;
+
+    // The ISR also drives EEAR: keep it quiet while reading
+    uint8_t eerie = EECR & (1 << EERIE);
+    EECR &= ~(1 << EERIE);
+    eeprom_busy_wait();
+    eeprom_read_block(dst, (const void *)(uintptr_t)(EEPROM_slot_address(ring, ring->valid_slot) + EEPROM_SEQUENCE_SIZE), ring->record_size);
+    EECR |= eerie;
+    return true;
+}
+
+bool EEPROM_ring_write(EEPROM_ring_t *ring, const void *src) {
+    bool is_merged = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 1; i < jobs_count; i++) {    // jobs_head is already being written
+            EEPROM_job_t *job = &jobs[(jobs_head + i) % EEPROM_N_JOBS];
+            if (job->ring == ring) {
+                EEPROM_frame_build(job, job->frame[0] | (uint16_t)job->frame[1] << 8, src);
+                is_merged = true;
+            }
+        }
+    }
+    if (is_merged) return true;
+
+    uint8_t slot = ring->slot + 1 == ring->n_slots ? 0 : ring->slot + 1;
+    EEPROM_job_t job = {
+        .ring     = ring,
+        .address  = EEPROM_slot_address(ring, slot),
+        .length   = EEPROM_RING_SLOT_SIZE(ring->record_size),
+        .position = 0,
+        .slot     = slot,
+    };
+    EEPROM_frame_build(&job, ring->sequence + 1, src);
+    if (!EEPROM_enqueue(&job)) return false;
+
+    ring->slot = job.slot;
+    ring->sequence++;
+    return true;
+}
+
+void EEPROM_ring_register_callback(EEPROM_ring_t *ring, EEPROM_callback_t callback, void *ctx) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {    // The ISR never sees a new function with the old ctx
+        ring->callback = (callback != NULL) ? callback : EEPROM_no_callback;
+        ring->ctx      = ctx;
+    }
+}
+
+bool EEPROM_IT_write_block(const void *src, uint16_t address, uint8_t length) {
+    EEPROM_job_t job = {
+        .ring     = NULL,
+        .data     = src,
+        .address  = address,
+        .length   = length,
+        .position = 0,
+    };
+    return EEPROM_enqueue(&job);
+}
+
+void EEPROM_register_raw_callback(EEPROM_callback_t callback, void *ctx) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        raw_callback = (callback != NULL) ? callback : EEPROM_no_callback;
+        raw_ctx      = ctx;
+    }
+}
+
+bool EEPROM_is_busy(void) {
+    return jobs_count || !eeprom_is_ready();
+}
+
+/* -------------------------------- Callbacks ------------------------------- */
+// Level triggered while EEPE is clear: one byte per interrupt, unchanged bytes are skipped
+ISR(EE_READY_vect) {
+    EEPROM_job_t *job = &jobs[jobs_head];
+
+    while (job->position < job->length) {
+        uint16_t address = job->address + job->position;
+        uint8_t byte     = EEPROM_job_byte(job);
+        job->position++;
+
+        EEAR = address;
+        EECR |= (1 << EERE);
+        if (EEDR == byte) continue;
+
+        EEDR = byte;
+        EECR |= (1 << EEMPE);
+        EECR |= (1 << EEPE);
+        return;
+    }
+
+    if (job->ring) {
+        job->ring->valid_slot = job->slot;
+        job->ring->is_empty   = false;
+        job->ring->callback(job->ring, job->ring->ctx);
+    } else {
+        raw_callback(NULL, raw_ctx);
+    }
+
+    jobs_head = (jobs_head + 1) % EEPROM_N_JOBS;
+    if (--jobs_count == 0) {
+        EECR &= ~(1 << EERIE);
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ * @file eeprom.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-22
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef EEPROM_MAX_RINGS
+#define EEPROM_MAX_RINGS 2
+#endif
+
+#ifndef EEPROM_N_JOBS
+#define EEPROM_N_JOBS 2    // A ring never queues more than two: the one being written and a merged one
+#endif
+
+#ifndef EEPROM_MAX_RECORD_SIZE
+#define EEPROM_MAX_RECORD_SIZE 60U    // Every job keeps a snapshot of its record
+#endif
+
+// Slot layout: sequence (2) | record | CRC16 of sequence and record (2)
+#define EEPROM_RING_SLOT_SIZE(record_size) ((record_size) + 4U)
+
+typedef struct {
+    uint16_t base;    // First EEPROM address of the region (e.g. an EEMEM array)
+    uint8_t n_slots;
+    uint8_t record_size;
+} EEPROM_ring_init_t;
+
+struct EEPROM_ring;
+typedef struct EEPROM_ring EEPROM_ring_t;
+
+// Write completion, called from the ISR with the ctx given at registration (ring is NULL for raw writes)
+typedef void (*EEPROM_callback_t)(EEPROM_ring_t *ring, void *ctx);
+
+/* Wear leveled records ----------------------- */
+// Scans the region and recovers the newest slot with a valid CRC (blocking, reads only)
+EEPROM_ring_t *EEPROM_ring_init(EEPROM_ring_init_t *cfg);
+bool EEPROM_ring_read(EEPROM_ring_t *ring, void *dst);
+
+// Queues a copy of the record into the next slot and returns immediately: src can be changed
+// right after. A save queued while an older one is still waiting replaces its copy.
+bool EEPROM_ring_write(EEPROM_ring_t *ring, const void *src);
+void EEPROM_ring_register_callback(EEPROM_ring_t *ring, EEPROM_callback_t callback, void *ctx);    // NULL unregisters
+
+/* Raw writes --------------------------------- */
+// Not copied: src must stay allocated and unchanged until the raw write callback
+bool EEPROM_IT_write_block(const void *src, uint16_t address, uint8_t length);
+void EEPROM_register_raw_callback(EEPROM_callback_t callback, void *ctx);    // NULL unregisters
+
+bool EEPROM_is_busy(void);
+
+#endif    // EEPROM_H
@@ -17,6 +17,7 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <stddef.h>
+#include <util/atomic.h>
 
 #define ASSERT_GPIO_PORT(port, err_value)                                     \
     do {                                                                      \
@@ -104,10 +105,19 @@ static inline __attribute__((always_inline)) void GPIO_PCICR_config(GPIO_port_t
     }
 }
 
+// PC0-PC5 (ADC low power channels) and PD6/PD7 (AIN0/AIN1, off since startup with USE_POWER)
+// may have their digital input buffer disabled, which reads the pin always as low
+static void GPIO_digital_input_enable(GPIO_port_t port, GPIO_pin_t pins) {
+    if (port == GPIO_PORTC) DIDR0 &= ~(pins & (1 << ADC5D | 1 << ADC4D | 1 << ADC3D | 1 << ADC2D | 1 << ADC1D | 1 << ADC0D));
+    if (port == GPIO_PORTD) DIDR1 &= ~((pins >> 6) & (1 << AIN1D | 1 << AIN0D));
+}
+
 void GPIO_config(GPIO_port_t port, GPIO_pin_t pins, GPIO_mode_t mode) {
     ASSERT_GPIO_PORT(port, );
     GPIO_regs_t reg = GPIO_get_registers(port);
 
+    if (mode >= GPIO_INPUT) GPIO_digital_input_enable(port, pins);    // Every mode from GPIO_INPUT on is an input
+
     switch (mode) {
     case GPIO_INPUT:
         *reg.ddrx &= ~pins;
@@ -190,24 +200,57 @@ GPIO_pin_state_t GPIO_read_pin(GPIO_port_t port, GPIO_pin_t pin) {
     return (*reg.pinx & pin) ? GPIO_HIGH : GPIO_LOW;
 }
 
+/* -------------------------------- Callbacks ------------------------------- */
+static void GPIO_no_EXTI_callback(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state, void *ctx) {
+}
+
+#define GPIO_EXTI_NO_CALLBACK {[0 ... 7] = {GPIO_no_EXTI_callback, NULL}}
+
+static struct {
+    GPIO_EXTI_callback_t function;
+    void *ctx;
+} GPIO_EXTI_callbacks[3][8] = {
+    [GPIO_PORTB] = GPIO_EXTI_NO_CALLBACK,
+    [GPIO_PORTC] = GPIO_EXTI_NO_CALLBACK,
+    [GPIO_PORTD] = GPIO_EXTI_NO_CALLBACK,
+};
+
+void GPIO_EXTI_register_callback(GPIO_port_t port, GPIO_pin_t pins, GPIO_EXTI_callback_t callback, void *ctx) {
+    ASSERT_GPIO_PORT(port, );
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {    // The ISR never sees a new function with the old ctx
+        for (uint8_t i = 0; i < 8; i++) {
+            if (!(pins & (1 << i))) continue;
+            GPIO_EXTI_callbacks[port][i].function = (callback != NULL) ? callback : GPIO_no_EXTI_callback;
+            GPIO_EXTI_callbacks[port][i].ctx      = ctx;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void GPIO_EXTI_dispatch(GPIO_port_t port, uint8_t index, GPIO_pin_state_t state) {
+    GPIO_EXTI_callbacks[port][index].function(port, (GPIO_pin_t)(1 << index), state, GPIO_EXTI_callbacks[port][index].ctx);
+}
+/* -------------------------------------------------------------------------- */
+
 ISR(INT0_vect) {
     GPIO_pin_state_t current_state = GPIO_read_pin(GPIO_PORTD, GPIO_2);
     switch (GPIO_INTx[0].mode) {
     case GPIO_INPUT_IT_FALLING:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_2, GPIO_EDGE_FALLING);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 2, GPIO_EDGE_FALLING);
         GPIO_INTx[0].state = GPIO_EDGE_FALLING;
         break;
     case GPIO_INPUT_IT_RISING:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_2, GPIO_EDGE_RISING);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 2, GPIO_EDGE_RISING);
         GPIO_INTx[0].state = GPIO_EDGE_RISING;
         break;
     case GPIO_INPUT_IT_LEVEL_CHANGE:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_2, current_state);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 2, current_state);
         GPIO_INTx[0].state = current_state;
+        break;
     case GPIO_INPUT_IT_LOW_LEVEL:
     case GPIO_INPUT_IT_LOW_LEVEL_WITH_PULLUP:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_2, GPIO_LOW);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 2, GPIO_LOW);
         GPIO_INTx[0].state = GPIO_LOW;
+        break;
     default:
         break;
     }
@@ -217,20 +260,22 @@ ISR(INT1_vect) {
     GPIO_pin_state_t current_state = GPIO_read_pin(GPIO_PORTD, GPIO_3);
     switch (GPIO_INTx[1].mode) {
     case GPIO_INPUT_IT_FALLING:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_3, GPIO_EDGE_FALLING);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 3, GPIO_EDGE_FALLING);
         GPIO_INTx[1].state = GPIO_EDGE_FALLING;
         break;
     case GPIO_INPUT_IT_RISING:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_3, GPIO_EDGE_RISING);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 3, GPIO_EDGE_RISING);
         GPIO_INTx[1].state = GPIO_EDGE_RISING;
         break;
     case GPIO_INPUT_IT_LEVEL_CHANGE:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_3, current_state);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 3, current_state);
         GPIO_INTx[1].state = current_state;
+        break;
     case GPIO_INPUT_IT_LOW_LEVEL:
     case GPIO_INPUT_IT_LOW_LEVEL_WITH_PULLUP:
-        GPIO_EXTI_callback(GPIO_PORTD, GPIO_3, GPIO_LOW);
+        GPIO_EXTI_dispatch(GPIO_PORTD, 3, GPIO_LOW);
         GPIO_INTx[1].state = GPIO_LOW;
+        break;
     default:
         break;
     }
@@ -244,26 +289,20 @@ ISR(PCINT0_vect) {
     uint8_t port_changes = (PINB & PCMSK0) ^ PORTB_last_value;
     if (port_changes == 0) return;    // None pin changed (should never happen)
 
-    for (GPIO_pin_t pin = GPIO_0; pin <= GPIO_7; pin <<= 1) {
-        if ((port_changes & pin) && (~PORTB_last_value & pin)) {
-            GPIO_EXTI_callback(GPIO_PORTB, pin, GPIO_EDGE_RISING);
-        } else if ((port_changes & pin) && (PORTB_last_value & ~pin)) {
-            GPIO_EXTI_callback(GPIO_PORTB, pin, GPIO_EDGE_FALLING);
-        }
+    for (uint8_t i = 0; i < 8; i++) {
+        if (!(port_changes & (1 << i))) continue;
+        GPIO_EXTI_dispatch(GPIO_PORTB, i, (PORTB_last_value & (1 << i)) ? GPIO_EDGE_FALLING : GPIO_EDGE_RISING);
     }
     PORTB_last_value = PINB & PCMSK0;
 }
 
 ISR(PCINT1_vect) {
-    uint8_t port_changes = (PINC & PCMSK1) ^ PORTB_last_value;
+    uint8_t port_changes = (PINC & PCMSK1) ^ PORTC_last_value;
     if (port_changes == 0) return;    // None pin changed (should never happen)
 
-    for (GPIO_pin_t pin = GPIO_0; pin <= GPIO_6; pin <<= 1) {
-        if ((port_changes & pin) && (~PORTB_last_value & pin)) {
-            GPIO_EXTI_callback(GPIO_PORTC, pin, GPIO_EDGE_RISING);
-        } else if ((port_changes & pin) && (PORTC_last_value & ~pin)) {
-            GPIO_EXTI_callback(GPIO_PORTC, pin, GPIO_EDGE_FALLING);
-        }
+    for (uint8_t i = 0; i < 7; i++) {
+        if (!(port_changes & (1 << i))) continue;
+        GPIO_EXTI_dispatch(GPIO_PORTC, i, (PORTC_last_value & (1 << i)) ? GPIO_EDGE_FALLING : GPIO_EDGE_RISING);
     }
     PORTC_last_value = PINC & PCMSK1;
 }
@@ -272,12 +311,9 @@ ISR(PCINT2_vect) {
     uint8_t port_changes = (PIND & PCMSK2) ^ PORTD_last_value;
     if (port_changes == 0) return;    // None pin changed (should never happen)
 
-    for (GPIO_pin_t pin = GPIO_0; pin <= GPIO_7; pin <<= 1) {
-        if ((port_changes & pin) && (~PORTD_last_value & pin)) {
-            GPIO_EXTI_callback(GPIO_PORTD, pin, GPIO_EDGE_RISING);
-        } else if ((port_changes & pin) && (PORTD_last_value & ~pin)) {
-            GPIO_EXTI_callback(GPIO_PORTD, pin, GPIO_EDGE_FALLING);
-        }
+    for (uint8_t i = 0; i < 8; i++) {
+        if (!(port_changes & (1 << i))) continue;
+        GPIO_EXTI_dispatch(GPIO_PORTD, i, (PORTD_last_value & (1 << i)) ? GPIO_EDGE_FALLING : GPIO_EDGE_RISING);
     }
     PORTD_last_value = PIND & PCMSK2;
 }
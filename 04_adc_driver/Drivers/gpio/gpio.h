@@ -62,6 +62,9 @@ void GPIO_toggle_pin(GPIO_port_t port, GPIO_pin_t pin);
 
 GPIO_pin_state_t GPIO_read_pin(GPIO_port_t port, GPIO_pin_t pin);
 
-extern void GPIO_EXTI_callback(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state);
+// External/pin change interrupt of the GPIO_INPUT_IT_x pins, called from the ISR with the
+// ctx registered for that pin. pins may select several pins of the port (NULL unregisters).
+typedef void (*GPIO_EXTI_callback_t)(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state, void *ctx);
+void GPIO_EXTI_register_callback(GPIO_port_t port, GPIO_pin_t pins, GPIO_EXTI_callback_t callback, void *ctx);
 
 #endif    // GPIO_H
\ No newline at end of file
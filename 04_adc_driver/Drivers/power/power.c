@@ -0,0 +1,51 @@
+/**
+ * @file power.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief Power reduction driver
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "power.h"
+
+#ifdef USE_POWER
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#define PWR_PRR_MSK (1 << PRTWI | 1 << PRTIM2 | 1 << PRTIM0 | 1 << PRTIM1 | 1 << PRSPI | 1 << PRUSART0 | 1 << PRADC)
+
+static uint8_t pwr_users[8] = {0};    // Indexed by PRR bit
+
+// Runs from the avr-libc .init8 section, after the C runtime setup and before main()
+void PWR_startup(void) __attribute__((naked, used, section(".init8")));
+void PWR_startup(void) {
+    PRR   = PWR_PRR_MSK;
+    ACSR  = (1 << ACD);    // No driver uses the analog comparator
+    DIDR1 = (1 << AIN1D | 1 << AIN0D);
+}
+
+void PWR_acquire(PWR_peripheral_t peripheral) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (pwr_users[peripheral]++ == 0) PRR &= ~(1 << peripheral);
+    }
+}
+
+void PWR_release(PWR_peripheral_t peripheral) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (pwr_users[peripheral] == 0) return;    // Unbalanced release
+        if (--pwr_users[peripheral] == 0) PRR |= (1 << peripheral);
+    }
+}
+
+bool PWR_is_active(PWR_peripheral_t peripheral) {
+    return !(PRR & (1 << peripheral));
+}
+
+#endif
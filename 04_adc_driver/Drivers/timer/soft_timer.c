@@ -0,0 +1,197 @@
+/**
+ * @file soft_timer.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-24
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "soft_timer.h"
+#include "timer.h"
+
+#include <stddef.h>
+#include <util/atomic.h>
+
+struct SWTIM_timer {
+    SWTIM_timer_t *next;
+    uint32_t delta_ticks;     // Ticks after the expiration of the previous timer in the list
+    uint32_t period_ticks;
+    uint32_t delay_ticks;
+    SWTIM_mode_t mode;
+    SWTIM_callback_t callback;
+    void *ctx;
+    bool is_running;
+    bool is_available;
+};
+
+static SWTIM_timer_t swtim_pool[SWTIM_MAX_TIMERS] = {[0 ... SWTIM_MAX_TIMERS - 1] = {.is_available = true}};
+static SWTIM_timer_t *swtim_head = NULL;    // Next timer to expire
+static uint16_t swtim_tick_us    = 1000;
+static bool swtim_is_tickless    = false;
+static uint32_t swtim_base       = 0;    // Tickless: timestamp the head delta counts from
+
+static uint32_t SWTIM_us_to_ticks(uint32_t us) {
+    uint32_t ticks = (us + swtim_tick_us - 1) / swtim_tick_us;
+    return ticks ? ticks : 1;
+}
+
+/* ------------------------------- Delta list ------------------------------- */
+// Tickless: ticks elapsed since the list base, a timer started now is inserted that much later.
+// An empty list is anchored to now first: its base is as old as the last expiration, and the
+// difference would wrap after 2^32 ticks (~4.77 h at 4 us). Called with interrupts disabled.
+static inline uint32_t SWTIM_elapsed(void) {
+    if (!swtim_is_tickless) return 0;
+    uint32_t now = TIM_tickless_now();
+    if (swtim_head == NULL) swtim_base = now;
+    return now - swtim_base;
+}
+
+static void SWTIM_reschedule(void) {
+    if (!swtim_is_tickless) return;
+    if (swtim_head) {
+        TIM_tickless_set_deadline(swtim_base + swtim_head->delta_ticks);
+    } else {
+        TIM_tickless_cancel();
+    }
+}
+
+// Called with interrupts disabled
+static void SWTIM_list_insert(SWTIM_timer_t *timer, uint32_t ticks) {
+    SWTIM_timer_t **link = &swtim_head;
+
+    // Timers with the same expiration keep their start order
+    while (*link && (*link)->delta_ticks <= ticks) {
+        ticks -= (*link)->delta_ticks;
+        link = &(*link)->next;
+    }
+    if (*link) (*link)->delta_ticks -= ticks;
+
+    timer->delta_ticks = ticks;
+    timer->next        = *link;
+    timer->is_running  = true;
+    *link              = timer;
+}
+
+// Called with interrupts disabled
+static void SWTIM_list_remove(SWTIM_timer_t *timer) {
+    SWTIM_timer_t **link = &swtim_head;
+
+    while (*link && *link != timer) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) return;
+
+    if (timer->next) timer->next->delta_ticks += timer->delta_ticks;
+    *link             = timer->next;
+    timer->next       = NULL;
+    timer->is_running = false;
+}
+/* -------------------------------------------------------------------------- */
+
+// Call before creating timers: periods are converted to ticks on creation
+void SWTIM_init(uint16_t tick_us) {
+    swtim_tick_us = tick_us ? tick_us : 1;
+}
+
+void SWTIM_init_tickless(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        swtim_tick_us     = TIM_tickless_get_tick_us();
+        swtim_base        = TIM_tickless_now();
+        swtim_is_tickless = true;
+    }
+}
+
+// Expires every timer due within ticks. Periodic timers are reloaded from their
+// expiration, not from now, so a late tick does not accumulate drift.
+static void SWTIM_advance(uint32_t ticks) {
+    while (swtim_head && swtim_head->delta_ticks <= ticks) {
+        SWTIM_timer_t *timer = swtim_head;
+        swtim_head           = timer->next;
+        timer->next          = NULL;
+        timer->is_running    = false;
+        ticks -= timer->delta_ticks;
+        swtim_base += timer->delta_ticks;    // The list now counts from this expiration
+
+        // Reinserted before the callback, which may stop or restart it
+        if (timer->mode == SWTIM_PERIODIC) SWTIM_list_insert(timer, timer->period_ticks);
+        timer->callback(timer, timer->ctx);
+    }
+    if (swtim_head) swtim_head->delta_ticks -= ticks;
+    swtim_base += ticks;
+}
+
+// Runs in interrupt context, and so do the callbacks
+void SWTIM_tick(void) {
+    if (!swtim_is_tickless) {
+        SWTIM_advance(1);
+        return;
+    }
+    SWTIM_advance(TIM_tickless_now() - swtim_base);
+    SWTIM_reschedule();
+}
+
+SWTIM_timer_t *SWTIM_create(SWTIM_init_t *cfg) {
+    if (cfg->callback == NULL) return NULL;
+
+    SWTIM_timer_t *timer = NULL;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < SWTIM_MAX_TIMERS; i++) {
+            if (swtim_pool[i].is_available) {
+                timer               = &swtim_pool[i];
+                timer->is_available = false;
+                break;
+            }
+        }
+    }
+    if (timer == NULL) return NULL;
+
+    timer->mode         = cfg->mode;
+    timer->callback     = cfg->callback;
+    timer->ctx          = cfg->ctx;
+    timer->period_ticks = SWTIM_us_to_ticks(cfg->period_us);
+    timer->delay_ticks  = cfg->delay_us ? SWTIM_us_to_ticks(cfg->delay_us) : timer->period_ticks;
+    timer->is_running   = false;
+    timer->next         = NULL;
+    return timer;
+}
+
+void SWTIM_delete(SWTIM_timer_t *timer) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        SWTIM_list_remove(timer);
+        SWTIM_reschedule();
+        timer->is_available = true;
+    }
+}
+
+void SWTIM_start(SWTIM_timer_t *timer) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (timer->is_running) SWTIM_list_remove(timer);
+        uint32_t elapsed = SWTIM_elapsed();
+        SWTIM_list_insert(timer, timer->delay_ticks > UINT32_MAX - elapsed ? UINT32_MAX : timer->delay_ticks + elapsed);
+        SWTIM_reschedule();
+    }
+}
+
+void SWTIM_stop(SWTIM_timer_t *timer) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        SWTIM_list_remove(timer);
+        SWTIM_reschedule();
+    }
+}
+
+void SWTIM_set_period_us(SWTIM_timer_t *timer, uint32_t period_us) {
+    uint32_t ticks = SWTIM_us_to_ticks(period_us);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        timer->period_ticks = ticks;
+    }
+}
+
+bool SWTIM_is_running(SWTIM_timer_t *timer) {
+    return timer->is_running;
+}
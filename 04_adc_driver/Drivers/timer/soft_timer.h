@@ -0,0 +1,62 @@
+/**
+ * @file soft_timer.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-05-24
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef SOFT_TIMER_H
+#define SOFT_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SWTIM_MAX_TIMERS
+#define SWTIM_MAX_TIMERS 16
+#endif
+
+struct SWTIM_timer;
+typedef struct SWTIM_timer SWTIM_timer_t;
+
+typedef void (*SWTIM_callback_t)(SWTIM_timer_t *timer, void *ctx);
+
+typedef enum {
+    SWTIM_ONE_SHOT,
+    SWTIM_PERIODIC,
+} SWTIM_mode_t;
+
+typedef struct {
+    SWTIM_mode_t mode;
+    uint32_t period_us;    // Rounded up to whole ticks
+    uint32_t delay_us;     // First expiration after start, 0 = one period
+    SWTIM_callback_t callback;
+    void *ctx;
+} SWTIM_init_t;
+
+// Every software timer is multiplexed on one hardware timer: its ISR (or callback) must
+// call SWTIM_tick() once every tick_us. Running timers are kept in a delta list sorted by
+// expiration, so a tick only decrements the head: O(1) regardless of the number of timers.
+void SWTIM_init(uint16_t tick_us);
+void SWTIM_tick(void);
+
+// Tickless: the list is driven by the TIM_1 timestamp (TIM_tickless_init must be called first)
+// and only the next expiration is programmed. Call before creating timers; the TIM_EVENT_DEADLINE
+// callback must call SWTIM_tick().
+void SWTIM_init_tickless(void);
+
+SWTIM_timer_t *SWTIM_create(SWTIM_init_t *cfg);
+void SWTIM_delete(SWTIM_timer_t *timer);
+
+void SWTIM_start(SWTIM_timer_t *timer);    // Restarts a running timer
+void SWTIM_stop(SWTIM_timer_t *timer);
+void SWTIM_set_period_us(SWTIM_timer_t *timer, uint32_t period_us);    // Applied on the next start/reload
+bool SWTIM_is_running(SWTIM_timer_t *timer);
+
+#endif    // SOFT_TIMER_H
@@ -19,19 +19,51 @@
 #include "timer.h"
 
 #include "../../board.h"
+#include "../clock/clock.h"
+#include "../gpio/gpio.h"
+#include "../power/power.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <util/atomic.h>
 
 #define TIM_8B_MAX_VALUE  255
 #define TIM_16B_MAX_VALUE 65535
 
+// TCNTx/OCRxA/OCRxB point to the low byte, they are 16 bit wide on TIM_1
+typedef struct {
+    volatile uint8_t *tccra;
+    volatile uint8_t *tccrb;
+    volatile uint8_t *tifr;
+    volatile uint8_t *timsk;
+    volatile uint8_t *tcnt;
+    volatile uint8_t *ocra;
+    volatile uint8_t *ocrb;
+} TIM_regs_t;
+
+typedef struct {
+    uint16_t top;
+    uint16_t duty[2];    // Q1.15, kept to rescale OCRx when TOP changes
+    uint8_t outputs;
+    uint16_t ocr[2];     // Staged values, written by the update interrupt
+    uint8_t com;         // Staged COMxA1/COMxB1 bits
+    volatile bool is_update_pending;
+} TIM_PWM_t;
+
 struct TIM_handle {
     TIM_init_t config;
     TIM_state_t state;
     bool is_available;
+    uint8_t clk_bits;    // CSx2:0 of config.clk_source, cached for the ISR path
+    TIM_regs_t regs;
+    TIM_PWM_t pwm;
+    struct {
+        TIM_callback_t function;
+        void *ctx;
+    } callbacks[TIM_N_EVENTS];
 };
 
 #define TOVx_SHIFT  0
@@ -54,67 +86,129 @@ struct TIM_handle {
 
 #define NO_CLK_SOURCE_MSK 7
 
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+#define TIM_F_CPU clock_get_f_cpu_hz()
+#else
+#define TIM_F_CPU F_CPU
+#endif
+
+// Tickless timestamp: prescaler giving a whole number of microseconds per tick, and a whole
+// number of ticks per millisecond (16 MHz: 4 us, 8 MHz: 8 us, 4/2/1 MHz: 2/4/8 us, 500 kHz: 2 us)
+#if F_CPU >= 8000000UL
+#define TIM_TICKLESS_PRESCALER  64UL
+#define TIM_TICKLESS_CLK_SOURCE TIM_CLK_INTERNAL_PRESCALER_DIV64
+#elif F_CPU >= 1000000UL
+#define TIM_TICKLESS_PRESCALER  8UL
+#define TIM_TICKLESS_CLK_SOURCE TIM_CLK_INTERNAL_PRESCALER_DIV8
+#else
+#define TIM_TICKLESS_PRESCALER  1UL
+#define TIM_TICKLESS_CLK_SOURCE TIM_CLK_INTERNAL_PRESCALER_DIV1
+#endif
+#define TIM_TICKLESS_TICK_US   (TIM_TICKLESS_PRESCALER * 1000000UL / F_CPU)
+#define TIM_TICKLESS_MIN_TICKS 2    // Closest deadline that can still be programmed
+
+#if (TIM_TICKLESS_PRESCALER * 1000000UL) % F_CPU != 0 || TIM_TICKLESS_TICK_US == 0 || 1000UL % TIM_TICKLESS_TICK_US != 0
+#error "F_CPU gives no whole number of microseconds per tickless tick and ticks per millisecond"
+#endif
+
+// Time base: milliseconds are accumulated per overflow so time_ms() never divides 32 bits
+#define TIM_TICKS_PER_MS     (1000U / TIM_TICKLESS_TICK_US)
+#define TIM_OVF_MS           (65536UL / TIM_TICKS_PER_MS)
+#define TIM_OVF_REM_TICKS    (65536UL % TIM_TICKS_PER_MS)
+#define TIM_MS_RECIPROCAL    ((1UL << 22) / TIM_TICKS_PER_MS)    // n / TICKS_PER_MS ~ n * RECIPROCAL >> 22
+#define TIM_MS_RECIPROCAL_SH 22
+
+static struct {
+    volatile uint16_t overflows;    // High word of the timestamp
+    volatile uint32_t deadline;
+    volatile uint32_t ms;           // Milliseconds at the last overflow
+    volatile uint16_t rem_ticks;    // Ticks past ms at the last overflow (< TIM_TICKS_PER_MS)
+} tickless = {0};
+
+static void TIM_no_callback(TIM_handle_t *htim, void *ctx) {
+}
+
+#define TIM_HANDLE_INIT {.is_available = true, .callbacks = {[0 ... TIM_N_EVENTS - 1] = {TIM_no_callback, NULL}}}
+
 static TIM_handle_t timer_handles[3] = {
-    [TIM_0] = {.is_available = true},
-    [TIM_1] = {.is_available = true},
-    [TIM_2] = {.is_available = true},
+    [TIM_0] = TIM_HANDLE_INIT,
+    [TIM_1] = TIM_HANDLE_INIT,
+    [TIM_2] = TIM_HANDLE_INIT,
 };
 
-void *TIM_get_TCNTx(TIM_timer_t timer) {
-    switch (timer) {
-    case TIM_0: return (void *)&TCNT0;
-    case TIM_1: return (void *)&TCNT1;
-    case TIM_2: return (void *)&TCNT2;
-    default: return NULL;    // Invalid timer
-    }
-}
-void *TIM_get_OCRxA(TIM_timer_t timer) {
-    switch (timer) {
-    case TIM_0: return (void *)&OCR0A;
-    case TIM_1: return (void *)&OCR1A;
-    case TIM_2: return (void *)&OCR2A;
-    default: return NULL;    // Invalid timer
-    }
-}
-void *TIM_get_OCRxB(TIM_timer_t timer) {
+/* ----------------------------- Register access ---------------------------- */
+// One descriptor per timer in flash, copied into the handle when it is registered: runtime
+// timer ids go through the cached pointers instead of a switch on every register access.
+static const TIM_regs_t tim_regs[3] PROGMEM = {
+    [TIM_0] = {&TCCR0A, &TCCR0B, &TIFR0, &TIMSK0, &TCNT0, &OCR0A, &OCR0B},
+    [TIM_1] = {&TCCR1A, &TCCR1B, &TIFR1, &TIMSK1, (volatile uint8_t *)&TCNT1, (volatile uint8_t *)&OCR1A, (volatile uint8_t *)&OCR1B},
+    [TIM_2] = {&TCCR2A, &TCCR2B, &TIFR2, &TIMSK2, &TCNT2, &OCR2A, &OCR2B},
+};
+
+// Constant timer ids (ISRs) fold these into direct I/O accesses, do not call them with a runtime id
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_TCNTx(TIM_timer_t timer) {
     switch (timer) {
-    case TIM_0: return (void *)&OCR0B;
-    case TIM_1: return (void *)&OCR1B;
-    case TIM_2: return (void *)&OCR2B;
-    default: return NULL;    // Invalid timer
+    case TIM_0: return &TCNT0;
+    case TIM_1: return (volatile uint8_t *)&TCNT1;
+    default: return &TCNT2;
     }
 }
-
-volatile uint8_t *TIM_get_TCCRxA(TIM_timer_t timer) {
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_TCCRxA(TIM_timer_t timer) {
     switch (timer) {
     case TIM_0: return &TCCR0A;
     case TIM_1: return &TCCR1A;
-    case TIM_2: return &TCCR2A;
-    default: return NULL;    // Invalid timer
+    default: return &TCCR2A;
     }
 }
-volatile uint8_t *TIM_get_TCCRxB(TIM_timer_t timer) {
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_TCCRxB(TIM_timer_t timer) {
     switch (timer) {
     case TIM_0: return &TCCR0B;
     case TIM_1: return &TCCR1B;
-    case TIM_2: return &TCCR2B;
-    default: return NULL;    // Invalid timer
+    default: return &TCCR2B;
     }
 }
-volatile uint8_t *TIM_get_TIFRx(TIM_timer_t timer) {
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_TIFRx(TIM_timer_t timer) {
     switch (timer) {
     case TIM_0: return &TIFR0;
     case TIM_1: return &TIFR1;
-    case TIM_2: return &TIFR2;
-    default: return NULL;    // Invalid timer
+    default: return &TIFR2;
     }
 }
-volatile uint8_t *TIM_get_TIMSKx(TIM_timer_t timer) {
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_TIMSKx(TIM_timer_t timer) {
     switch (timer) {
     case TIM_0: return &TIMSK0;
     case TIM_1: return &TIMSK1;
-    case TIM_2: return &TIMSK2;
-    default: return NULL;    // Invalid timer
+    default: return &TIMSK2;
+    }
+}
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_OCRxA(TIM_timer_t timer) {
+    switch (timer) {
+    case TIM_0: return &OCR0A;
+    case TIM_1: return (volatile uint8_t *)&OCR1A;
+    default: return &OCR2A;
+    }
+}
+static inline __attribute__((always_inline)) volatile uint8_t *TIM_get_OCRxB(TIM_timer_t timer) {
+    switch (timer) {
+    case TIM_0: return &OCR0B;
+    case TIM_1: return (volatile uint8_t *)&OCR1B;
+    default: return &OCR2B;
+    }
+}
+
+// TCNTx/OCRx of TIM_1 are written high byte first through the TEMP register
+static inline __attribute__((always_inline)) void TIM_write_reg(TIM_handle_t *htim, volatile uint8_t *reg, uint16_t value) {
+    if (htim->config.timer == TIM_1) {
+        *(volatile uint16_t *)reg = value;
+    } else {
+        *reg = (uint8_t)value;
+    }
+}
+static inline __attribute__((always_inline)) void TIM_write_reg_const(TIM_timer_t timer, volatile uint8_t *reg, uint16_t value) {
+    if (timer == TIM_1) {
+        *(volatile uint16_t *)reg = value;
+    } else {
+        *reg = (uint8_t)value;
     }
 }
 
@@ -146,32 +240,59 @@ static uint8_t TIM_get_clk_source_bits(TIM_handle_t *htim) {
     }
 }
 
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+static bool TIM_clock_notifier(CLK_event_t event, clk_prescaler_t from, clk_prescaler_t to, void *ctx);
+#endif
+
+static const PWR_peripheral_t tim_power[3] = {[TIM_0] = PWR_TIM0, [TIM_1] = PWR_TIM1, [TIM_2] = PWR_TIM2};
+
 static TIM_handle_t *TIM_register_handle(TIM_timer_t timer) {
     if (!timer_handles[timer].is_available) return NULL;
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    static bool is_notifier_registered = false;
+    if (!is_notifier_registered) is_notifier_registered = clock_register_notifier(TIM_clock_notifier, NULL);
+#endif
+    PWR_acquire(tim_power[timer]);    // Before the registers are written by the init
     timer_handles[timer].is_available = false;
+    memcpy_P(&timer_handles[timer].regs, &tim_regs[timer], sizeof(TIM_regs_t));
     return &timer_handles[timer];
 }
 
+static void TIM_unregister_handle(TIM_handle_t *htim) {
+    htim->is_available = true;
+    PWR_release(tim_power[htim->config.timer]);
+}
+
 static void TIM_set_clk_source(TIM_handle_t *htim) {
-    *TIM_get_TCCRxB(htim->config.timer) |= TIM_get_clk_source_bits(htim);
+    htim->clk_bits = TIM_get_clk_source_bits(htim);
+    *htim->regs.tccrb |= htim->clk_bits;
     htim->state = TIM_STATE_BUSY;
 }
 
 static void TIM_clear_clk_source(TIM_handle_t *htim) {
-    *TIM_get_TCCRxB(htim->config.timer) &= ~NO_CLK_SOURCE_MSK;
+    *htim->regs.tccrb &= ~NO_CLK_SOURCE_MSK;
     htim->state = TIM_STATE_READY;
 }
 
+// NORMAL_TIMER_AUTORELOAD runs in CTC mode: the counter restarts at TOP in hardware, so the
+// period no longer drifts with the ISR latency and the callback length. TOP = MAX - preset_value
+// keeps the period of a TCNT reload. The period flag is then OCFxA (ICF1 on TIM_1) instead of
+// TOVx; the interrupt enable bits sit at the same positions in TIMSKx.
+static inline __attribute__((always_inline)) uint8_t TIM_get_period_flag(TIM_handle_t *htim) {
+    if (htim->config.mode != NORMAL_TIMER_AUTORELOAD) return (1 << TOVx_SHIFT);
+    return (htim->config.timer == TIM_1) ? (1 << ICF1) : (1 << OCFxA_SHIFT);
+}
+
 inline TIM_state_t TIM_get_state(TIM_handle_t *htim) {
 
-    volatile uint8_t *flag_reg = TIM_get_TIFRx(htim->config.timer);
+    volatile uint8_t *flag_reg = htim->regs.tifr;
     TIM_mode_t mode            = htim->config.mode;
 
-    if ((mode == NORMAL_ONE_SHOT || mode == NORMAL_TIMER_AUTORELOAD) && (*flag_reg & (1 << TOVx_SHIFT))) {
+    if ((mode == NORMAL_ONE_SHOT || mode == NORMAL_TIMER_AUTORELOAD) && (*flag_reg & TIM_get_period_flag(htim))) {
         if (htim->config.mode == NORMAL_ONE_SHOT) {
             TIM_clear_clk_source(htim);
         }
-        *flag_reg   = (1 << TOVx_SHIFT);
+        *flag_reg   = TIM_get_period_flag(htim);
         htim->state = TIM_STATE_TIMEOUT;
     } else if (mode == CTC_CHANNEL_A_NO_OUTPUT && (*flag_reg & (1 << OCFxA_SHIFT))) {
         *flag_reg   = (1 << OCFxA_SHIFT);
@@ -186,6 +307,19 @@ inline TIM_state_t TIM_get_state(TIM_handle_t *htim) {
     return htim->state;
 }
 
+void TIM_register_callback(TIM_handle_t *htim, TIM_event_t event, TIM_callback_t callback, void *ctx) {
+    if (event >= TIM_N_EVENTS) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {    // The ISR never sees a new function with the old ctx
+        htim->callbacks[event].function = (callback != NULL) ? callback : TIM_no_callback;
+        htim->callbacks[event].ctx      = ctx;
+    }
+}
+
+// The only work of the ISRs around the user code: one indirect call
+static inline __attribute__((always_inline)) void TIM_dispatch(TIM_handle_t *htim, TIM_event_t event) {
+    htim->callbacks[event].function(htim, htim->callbacks[event].ctx);
+}
+
 /* ------------------------------- Base timer ------------------------------- */
 TIM_handle_t *TIM_base_init(TIM_init_t *cfg) {
 
@@ -198,37 +332,82 @@ TIM_handle_t *TIM_base_init(TIM_init_t *cfg) {
     htim->config.preset_value = cfg->preset_value;
     htim->state               = TIM_STATE_READY;
 
-    *TIM_get_TCCRxA(cfg->timer) = 0;
-    *TIM_get_TCCRxB(cfg->timer) = 0;
+    *htim->regs.tccra = 0;
+    *htim->regs.tccrb = 0;
+
+    if (cfg->mode == NORMAL_TIMER_AUTORELOAD) {
+        if (cfg->timer == TIM_1) {
+            *htim->regs.tccrb = (1 << WGM13 | 1 << WGM12);    // CTC, TOP = ICR1
+        } else {
+            *htim->regs.tccra = (1 << WGMx1_SHIFT);    // CTC, TOP = OCRxA
+        }
+    }
 
     return htim;
 }
 
 void TIM_base_start(TIM_handle_t *htim) {
-    if (htim->config.timer == TIM_1) {
-        *(uint16_t *)TIM_get_TCNTx(htim->config.timer) = htim->config.preset_value;
+    if (htim->config.mode == NORMAL_TIMER_AUTORELOAD) {
+        if (htim->config.timer == TIM_1) {
+            ICR1 = TIM_16B_MAX_VALUE - htim->config.preset_value;
+        } else {
+            TIM_write_reg(htim, htim->regs.ocra, TIM_8B_MAX_VALUE - htim->config.preset_value);
+        }
+        TIM_write_reg(htim, htim->regs.tcnt, 0);
     } else {
-        *(uint8_t *)TIM_get_TCNTx(htim->config.timer) = htim->config.preset_value;
+        TIM_write_reg(htim, htim->regs.tcnt, htim->config.preset_value);
     }
     TIM_set_clk_source(htim);
 }
 
+// ISR one shot end, constant timer
+static inline __attribute__((always_inline)) void TIM_base_stop_IT_const(TIM_handle_t *htim, TIM_timer_t timer) {
+    *TIM_get_TIMSKx(timer) &= ~(1 << TOIEx_SHIFT);
+    *TIM_get_TCCRxB(timer) &= ~NO_CLK_SOURCE_MSK;
+    *TIM_get_TIFRx(timer) = (1 << TOVx_SHIFT);
+    htim->state           = TIM_STATE_READY;
+}
+
 void TIM_base_stop(TIM_handle_t *htim) {
     TIM_clear_clk_source(htim);
-    *TIM_get_TIFRx(htim->config.timer) |= (1 << TOVx_SHIFT);    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
+    *htim->regs.tifr |= TIM_get_period_flag(htim);    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
 }
 
 void TIM_base_start_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) |= (1 << TOIEx_SHIFT);
+    *htim->regs.timsk |= TIM_get_period_flag(htim);
     TIM_base_start(htim);
 }
 
 void TIM_base_stop_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) &= ~(1 << TOIEx_SHIFT);
+    *htim->regs.timsk &= ~TIM_get_period_flag(htim);
     TIM_base_stop(htim);
 }
 /* -------------------------------------------------------------------------- */
 
+/* ------------------------------ Period solver ----------------------------- */
+uint32_t TIM_solve_period_us(TIM_init_t *cfg, uint32_t period_us) {
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    return TIM_period_solve(cfg, period_us, clock_get_prescaler());    // Starts at CLK_DIV_8 with the CKDIV8 fuse
+#else
+    return TIM_period_solve(cfg, period_us, TIM_CPU_CLK_SHIFT);
+#endif
+}
+/* -------------------------------------------------------------------------- */
+
+// OC0A PD6, OC0B PD5, OC1A PB1, OC1B PB2, OC2A PB3, OC2B PD3
+static const struct {
+    GPIO_port_t port;
+    GPIO_pin_t pin;
+} oc_pins[3][2] = {
+    [TIM_0] = {{GPIO_PORTD, GPIO_6}, {GPIO_PORTD, GPIO_5}},
+    [TIM_1] = {{GPIO_PORTB, GPIO_1}, {GPIO_PORTB, GPIO_2}},
+    [TIM_2] = {{GPIO_PORTB, GPIO_3}, {GPIO_PORTD, GPIO_3}},
+};
+
+static void TIM_config_oc_pin(TIM_timer_t timer, uint8_t channel) {
+    GPIO_config(oc_pins[timer][channel].port, oc_pins[timer][channel].pin, GPIO_OUTPUT_INITIAL_LOW);
+}
+
 /* -------------------------------- CTC timer ------------------------------- */
 // Necesito definir Compare Output Mode (COMxA1, COMxA0, COMxB1, COMxB0) en TCCRxA
 // Esto describe como se comportara el pin de salida asociado al canal A o B
@@ -239,15 +418,22 @@ void TIM_base_stop_IT(TIM_handle_t *htim) {
 // WGMx: 011 = Fast PWM (limite superior = 0xFF)
 // WGMx: 101 = PWM, Phase Correct (limite superior = OCRxA)
 // WGMx: 111 = Fast PWM (limite superior = OCRxA)
-// TODO: Agregar configuracion de pin correspondiente mediante GPIO driver
-// Mirar alternate function de la libreria GPIO
+// Los modos con pin configuran COMxA/COMxB y el pin OCxA/OCxB como salida (arranca en bajo)
 TIM_handle_t *TIM_CTC_init(TIM_init_t *cfg) {
     TIM_handle_t *htim = TIM_base_init(cfg);
     if (htim == NULL) return NULL;
     if (cfg->timer == TIM_1) {
-        *TIM_get_TCCRxB(cfg->timer) |= (1 << WGM12);    // CTC mode TIM_1
+        *htim->regs.tccrb |= (1 << WGM12);    // CTC mode TIM_1
     } else {
-        *TIM_get_TCCRxA(cfg->timer) |= (1 << WGMx1_SHIFT);    // CTC mode TIM_0 and TIM_2
+        *htim->regs.tccra |= (1 << WGMx1_SHIFT);    // CTC mode TIM_0 and TIM_2
+    }
+
+    if (cfg->mode >= CTC_CHANNEL_A_PIN_TOGGLE && cfg->mode <= CTC_CHANNEL_B_PIN_SET) {
+        uint8_t offset  = cfg->mode - CTC_CHANNEL_A_NO_OUTPUT;    // TIM_mode_t alternates A and B
+        uint8_t channel = offset & 1;                             // TIM_PWM_CHANNEL_A or TIM_PWM_CHANNEL_B
+        uint8_t com     = offset >> 1;                            // COMx1:0 = 01 toggle, 10 clear, 11 set
+        *htim->regs.tccra |= com << (channel == TIM_PWM_CHANNEL_A ? COMxA0_SHIFT : COMxB0_SHIFT);
+        TIM_config_oc_pin(cfg->timer, channel);
     }
     return htim;
 }
@@ -259,23 +445,11 @@ static void TIM_set_compare_value(TIM_handle_t *htim) {
         htim->config.mode == CTC_CHANNEL_A_PIN_CLEAR ||
         htim->config.mode == CTC_CHANNEL_A_PIN_SET) {
 
-        if (htim->config.timer == TIM_1) {
-            *(uint16_t *)TIM_get_OCRxA(htim->config.timer) = htim->config.preset_value;
-            *(uint16_t *)TIM_get_TCNTx(htim->config.timer) = 0;
-        } else {
-            *(uint8_t *)TIM_get_OCRxA(htim->config.timer) = htim->config.preset_value;
-            *(uint8_t *)TIM_get_TCNTx(htim->config.timer) = 0;
-        }
+        TIM_write_reg(htim, htim->regs.ocra, htim->config.preset_value);
     } else {
-        if (htim->config.timer == TIM_1) {
-            *(uint16_t *)TIM_get_OCRxB(htim->config.timer) = htim->config.preset_value;
-            *(uint16_t *)TIM_get_TCNTx(htim->config.timer) = 0;
-
-        } else {
-            *(uint8_t *)TIM_get_OCRxB(htim->config.timer) = htim->config.preset_value;
-            *(uint8_t *)TIM_get_TCNTx(htim->config.timer) = 0;
-        }
+        TIM_write_reg(htim, htim->regs.ocrb, htim->config.preset_value);
     }
+    TIM_write_reg(htim, htim->regs.tcnt, 0);
 }
 
 void TIM_CTC_A_start(TIM_handle_t *htim) {
@@ -284,7 +458,7 @@ void TIM_CTC_A_start(TIM_handle_t *htim) {
 }
 void TIM_CTC_A_stop(TIM_handle_t *htim) {
     TIM_clear_clk_source(htim);
-    *TIM_get_TIFRx(htim->config.timer) |= 1 << OCFxA_SHIFT;    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
+    *htim->regs.tifr |= 1 << OCFxA_SHIFT;    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
 }
 
 void TIM_CTC_B_start(TIM_handle_t *htim) {
@@ -294,109 +468,649 @@ void TIM_CTC_B_start(TIM_handle_t *htim) {
 
 void TIM_CTC_B_stop(TIM_handle_t *htim) {
     TIM_clear_clk_source(htim);
-    *TIM_get_TIFRx(htim->config.timer) |= 1 << OCFxB_SHIFT;    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
+    *htim->regs.tifr |= 1 << OCFxB_SHIFT;    // Clear by writing 1 (p.88 - 14.9.7 TIFR0 (apply to all timers))
 }
 
 void TIM_CTC_A_start_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) |= (1 << OCIExA_SHIFT);
+    *htim->regs.timsk |= (1 << OCIExA_SHIFT);
     TIM_CTC_A_start(htim);
 }
 void TIM_CTC_A_stop_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) &= ~(1 << OCIExA_SHIFT);
+    *htim->regs.timsk &= ~(1 << OCIExA_SHIFT);
     TIM_CTC_A_stop(htim);
 }
 void TIM_CTC_B_start_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) |= (1 << OCIExB_SHIFT);
+    *htim->regs.timsk |= (1 << OCIExB_SHIFT);
     TIM_CTC_B_start(htim);
 }
 void TIM_CTC_B_stop_IT(TIM_handle_t *htim) {
-    *TIM_get_TIMSKx(htim->config.timer) &= ~(1 << OCIExB_SHIFT);
+    *htim->regs.timsk &= ~(1 << OCIExB_SHIFT);
     TIM_CTC_B_stop(htim);
 }
 /* -------------------------------------------------------------------------- */
 
-/* -------------------------------- Callbacks ------------------------------- */
-// TODO: Agregar a cada COMPARE ISR el caso de output mode
-ISR(TIMER0_OVF_vect) {
-    if (timer_handles[TIM_0].state == TIM_STATE_BUSY) {
+/* -------------------------------- PWM timer ------------------------------- */
+// WGMx: 011 = Fast PWM, TOP 0xFF (TIM_0, TIM_2)     WGM1: 1110 = Fast PWM, TOP ICR1
+// WGMx: 001 = Phase Correct, TOP 0xFF (TIM_0, TIM_2) WGM1: 1000 = Phase and Frequency Correct, TOP ICR1
+// Fast:          f = F_CPU / (N * (TOP + 1)), duty = (OCR + 1) / (TOP + 1) (OCR = 0 is a one cycle spike)
+// Phase correct: f = F_CPU / (2 * N * TOP),   duty = OCR / TOP
+#define TIM_PWM_MIN_TOP 3U    // 2 bit resolution, datasheet minimum
+
+static const struct {
+    TIM_clk_source_t clk_source;
+    uint16_t div;
+} tim_prescalers[] = {
+    {TIM_CLK_INTERNAL_PRESCALER_DIV1, 1},
+    {TIM_CLK_INTERNAL_PRESCALER_DIV8, 8},
+    {TIM_CLK_INTERNAL_PRESCALER_DIV32, 32},    // TIM_2 only
+    {TIM_CLK_INTERNAL_PRESCALER_DIV64, 64},
+    {TIM_CLK_INTERNAL_PRESCALER_DIV128, 128},    // TIM_2 only
+    {TIM_CLK_INTERNAL_PRESCALER_DIV256, 256},
+    {TIM_CLK_INTERNAL_PRESCALER_DIV1024, 1024},
+};
+#define TIM_N_PRESCALERS (sizeof(tim_prescalers) / sizeof(tim_prescalers[0]))
+
+static bool TIM_prescaler_is_valid(TIM_timer_t timer, TIM_clk_source_t clk_source) {
+    if (clk_source == TIM_CLK_INTERNAL_PRESCALER_DIV32 || clk_source == TIM_CLK_INTERNAL_PRESCALER_DIV128) {
+        return timer == TIM_2;
+    }
+    return true;
+}
+
+static uint16_t TIM_get_prescaler_div(TIM_clk_source_t clk_source) {
+    for (uint8_t i = 0; i < TIM_N_PRESCALERS; i++) {
+        if (tim_prescalers[i].clk_source == clk_source) return tim_prescalers[i].div;
+    }
+    return 1;
+}
+
+static inline __attribute__((always_inline)) bool TIM_PWM_is_fast(TIM_handle_t *htim) {
+    return htim->config.mode == PWM_FAST;
+}
+
+// Counter clocks per PWM period for a given prescaler and TOP
+static uint32_t TIM_PWM_period_counts(TIM_handle_t *htim, uint16_t div, uint16_t top) {
+    return TIM_PWM_is_fast(htim) ? (uint32_t)div * (top + 1UL) : 2UL * div * top;
+}
+
+// TIM_1: smallest prescaler whose TOP fits 16 bits. TIM_0/TIM_2: TOP is fixed, closest frequency.
+static bool TIM_PWM_solve(TIM_handle_t *htim, uint32_t frequency_cHz) {
+    if (frequency_cHz == 0) return false;
+    uint32_t counts = (TIM_F_CPU * 100UL + frequency_cHz / 2) / frequency_cHz;    // CPU clocks per period
+
+    if (htim->config.timer == TIM_1) {
+        for (uint8_t i = 0; i < TIM_N_PRESCALERS; i++) {
+            if (!TIM_prescaler_is_valid(TIM_1, tim_prescalers[i].clk_source)) continue;
+            uint32_t top = TIM_PWM_is_fast(htim) ? (counts + tim_prescalers[i].div / 2) / tim_prescalers[i].div - 1
+                                                 : (counts + tim_prescalers[i].div) / (2UL * tim_prescalers[i].div);
+            if (top > TIM_16B_MAX_VALUE) continue;
+            if (top < TIM_PWM_MIN_TOP) return false;
+            htim->config.clk_source = tim_prescalers[i].clk_source;
+            htim->pwm.top           = top;
+            return true;
+        }
+        return false;
+    }
 
-        timer_handles[TIM_0].state = TIM_STATE_TIMEOUT;
-        TIM_period_elapsed_callback(&timer_handles[TIM_0]);
+    uint32_t best_error = UINT32_MAX;
+    for (uint8_t i = 0; i < TIM_N_PRESCALERS; i++) {
+        if (!TIM_prescaler_is_valid(htim->config.timer, tim_prescalers[i].clk_source)) continue;
+        uint32_t period = TIM_PWM_period_counts(htim, tim_prescalers[i].div, TIM_8B_MAX_VALUE);
+        uint32_t error  = period > counts ? period - counts : counts - period;
+        if (error < best_error) {
+            best_error              = error;
+            htim->config.clk_source = tim_prescalers[i].clk_source;
+        }
+    }
+    htim->pwm.top = TIM_8B_MAX_VALUE;
+    return true;
+}
 
-        if (timer_handles[TIM_0].config.mode == NORMAL_ONE_SHOT) {
-            TIM_base_stop_IT(&timer_handles[TIM_0]);
+// Called with the update not pending (or interrupts disabled)
+static void TIM_PWM_stage(TIM_handle_t *htim) {
+    htim->pwm.com = 0;
+    for (uint8_t ch = TIM_PWM_CHANNEL_A; ch <= TIM_PWM_CHANNEL_B; ch++) {
+        uint16_t duty = htim->pwm.duty[ch];
+        uint32_t ocr;
+        if (TIM_PWM_is_fast(htim)) {
+            ocr = (((uint32_t)htim->pwm.top + 1) * duty) >> 15;
+            if (ocr) ocr--;
         } else {
-            TIM_base_start(&timer_handles[TIM_0]);
+            ocr = ((uint32_t)htim->pwm.top * duty) >> 15;
+        }
+        htim->pwm.ocr[ch] = ocr;
+
+        // Fast PWM cannot output 0%: the pin is disconnected and stays low
+        if ((htim->pwm.outputs & (1 << ch)) && duty) {
+            htim->pwm.com |= (ch == TIM_PWM_CHANNEL_A) ? (1 << COMxA1_SHIFT) : (1 << COMxB1_SHIFT);
         }
     }
 }
-ISR(TIMER0_COMPA_vect) {
-    if (timer_handles[TIM_0].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_0].state = TIM_STATE_MATCH_A;
-        TIM_CTC_callback(&timer_handles[TIM_0]);
-        timer_handles[TIM_0].state = TIM_STATE_BUSY;
+
+// Interrupt that applies the staged values: the overflow (TOP in fast mode, BOTTOM in phase
+// correct), except TIM_1 phase correct. There OCR1x are latched at BOTTOM but ICR1 is not
+// double buffered, so both are written at TOP (ICF1) and take effect together at the next BOTTOM.
+static inline __attribute__((always_inline)) uint8_t TIM_PWM_update_irq(TIM_handle_t *htim) {
+    return (htim->config.timer == TIM_1 && htim->config.mode == PWM_PHASE_CORRECT) ? (1 << ICIE1) : (1 << TOIEx_SHIFT);
+}
+
+static inline __attribute__((always_inline)) void TIM_PWM_apply(TIM_handle_t *htim) {
+    if (htim->config.timer == TIM_1) ICR1 = htim->pwm.top;
+    TIM_write_reg(htim, htim->regs.ocra, htim->pwm.ocr[TIM_PWM_CHANNEL_A]);
+    TIM_write_reg(htim, htim->regs.ocrb, htim->pwm.ocr[TIM_PWM_CHANNEL_B]);
+    *htim->regs.tccra = (*htim->regs.tccra & ~(1 << COMxA1_SHIFT | 1 << COMxB1_SHIFT)) | htim->pwm.com;
+
+    htim->pwm.is_update_pending = false;
+    *htim->regs.timsk &= ~TIM_PWM_update_irq(htim);
+}
+
+// ISR update, constant timer
+static inline __attribute__((always_inline)) void TIM_PWM_apply_const(TIM_handle_t *htim, TIM_timer_t timer) {
+    if (timer == TIM_1) ICR1 = htim->pwm.top;
+    TIM_write_reg_const(timer, TIM_get_OCRxA(timer), htim->pwm.ocr[TIM_PWM_CHANNEL_A]);
+    TIM_write_reg_const(timer, TIM_get_OCRxB(timer), htim->pwm.ocr[TIM_PWM_CHANNEL_B]);
+    *TIM_get_TCCRxA(timer) = (*TIM_get_TCCRxA(timer) & ~(1 << COMxA1_SHIFT | 1 << COMxB1_SHIFT)) | htim->pwm.com;
+
+    htim->pwm.is_update_pending = false;
+    *TIM_get_TIMSKx(timer) &= (timer == TIM_1 && htim->config.mode == PWM_PHASE_CORRECT) ? ~(1 << ICIE1) : ~(1 << TOIEx_SHIFT);
+}
+
+static void TIM_PWM_request_update(TIM_handle_t *htim) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIM_PWM_stage(htim);
+        if (htim->state != TIM_STATE_BUSY) {
+            TIM_PWM_apply(htim);    // Stopped: nothing to glitch
+        } else if (!htim->pwm.is_update_pending) {
+            htim->pwm.is_update_pending = true;
+            *htim->regs.tifr  = TIM_PWM_update_irq(htim);    // A stale flag would apply it right away
+            *htim->regs.timsk |= TIM_PWM_update_irq(htim);
+        }
     }
 }
-ISR(TIMER0_COMPB_vect) {
-    if (timer_handles[TIM_0].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_0].state = TIM_STATE_MATCH_B;
-        TIM_CTC_callback(&timer_handles[TIM_0]);
-        timer_handles[TIM_0].state = TIM_STATE_BUSY;
+
+static void TIM_PWM_config_pins(TIM_timer_t timer, uint8_t outputs) {
+    for (uint8_t ch = TIM_PWM_CHANNEL_A; ch <= TIM_PWM_CHANNEL_B; ch++) {
+        if (outputs & (1 << ch)) TIM_config_oc_pin(timer, ch);
     }
 }
 
-ISR(TIMER1_OVF_vect) {
-    if (timer_handles[TIM_1].state == TIM_STATE_BUSY) {
+TIM_handle_t *TIM_PWM_init(TIM_PWM_init_t *cfg) {
+    if (cfg->mode != PWM_FAST && cfg->mode != PWM_PHASE_CORRECT) return NULL;
 
-        timer_handles[TIM_1].state = TIM_STATE_TIMEOUT;
-        TIM_period_elapsed_callback(&timer_handles[TIM_1]);
+    TIM_init_t base_cfg = {
+        .timer        = cfg->timer,
+        .clk_source   = TIM_CLK_INTERNAL_PRESCALER_DIV1,
+        .preset_value = 0,
+        .mode         = cfg->mode,
+    };
+    TIM_handle_t *htim = TIM_base_init(&base_cfg);
+    if (htim == NULL) return NULL;
 
-        if (timer_handles[TIM_1].config.mode == NORMAL_ONE_SHOT) {
-            TIM_base_stop_IT(&timer_handles[TIM_1]);
-        } else {
-            TIM_base_start(&timer_handles[TIM_1]);
+    htim->pwm = (TIM_PWM_t){.outputs = cfg->outputs};
+    if (!TIM_PWM_solve(htim, cfg->frequency_cHz)) {
+        TIM_unregister_handle(htim);
+        return NULL;
+    }
+
+    if (cfg->timer == TIM_1) {
+        TCCR1A = (cfg->mode == PWM_FAST) ? (1 << WGM11) : 0;
+        TCCR1B = (cfg->mode == PWM_FAST) ? (1 << WGM13 | 1 << WGM12) : (1 << WGM13);
+    } else {
+        *htim->regs.tccra = (cfg->mode == PWM_FAST) ? (1 << WGMx1_SHIFT | 1 << WGMx0_SHIFT) : (1 << WGMx0_SHIFT);
+    }
+
+    TIM_PWM_config_pins(cfg->timer, cfg->outputs);
+    TIM_PWM_request_update(htim);
+    return htim;
+}
+
+void TIM_PWM_start(TIM_handle_t *htim) {
+    TIM_write_reg(htim, htim->regs.tcnt, 0);
+    TIM_set_clk_source(htim);
+}
+
+void TIM_PWM_stop(TIM_handle_t *htim) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIM_clear_clk_source(htim);
+        *htim->regs.timsk &= ~TIM_PWM_update_irq(htim);
+        *htim->regs.tccra &= ~(1 << COMxA1_SHIFT | 1 << COMxB1_SHIFT);
+        htim->pwm.is_update_pending = false;
+    }
+}
+
+void TIM_PWM_set_duty(TIM_handle_t *htim, TIM_PWM_channel_t channel, uint16_t duty) {
+    if (duty > TIM_PWM_DUTY_MAX) duty = TIM_PWM_DUTY_MAX;
+    htim->pwm.duty[channel & 1] = duty;
+    TIM_PWM_request_update(htim);
+}
+
+bool TIM_PWM_set_frequency_cHz(TIM_handle_t *htim, uint32_t frequency_cHz) {
+    if (htim->config.timer != TIM_1) return false;
+
+    TIM_clk_source_t clk_source = htim->config.clk_source;
+    uint16_t top                = htim->pwm.top;
+    if (!TIM_PWM_solve(htim, frequency_cHz)) return false;
+
+    if (htim->config.clk_source != clk_source && htim->state == TIM_STATE_BUSY) {
+        // The prescaler cannot change at TOP: switch it right away with the new TOP
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            TIM_clear_clk_source(htim);
+            TIM_PWM_stage(htim);
+            TIM_PWM_apply(htim);
+            TCNT1 = 0;
+            TIM_set_clk_source(htim);
         }
+        return true;
     }
+    if (htim->pwm.top != top) TIM_PWM_request_update(htim);
+    return true;
 }
-ISR(TIMER1_COMPA_vect) {
-    if (timer_handles[TIM_1].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_1].state = TIM_STATE_MATCH_A;
-        TIM_CTC_callback(&timer_handles[TIM_1]);
-        timer_handles[TIM_1].state = TIM_STATE_BUSY;
+
+uint32_t TIM_PWM_get_frequency_cHz(TIM_handle_t *htim) {
+    uint32_t counts = TIM_PWM_period_counts(htim, TIM_get_prescaler_div(htim->config.clk_source), htim->pwm.top);
+    return (TIM_F_CPU * 100UL + counts / 2) / counts;
+}
+/* -------------------------------------------------------------------------- */
+
+/* ------------------------------ Input capture ----------------------------- */
+#define TIM_IC_BUFFER_MSK (TIM_IC_BUFFER_SIZE - 1)
+
+typedef struct {
+    TIM_IC_capture_t buffer[TIM_IC_BUFFER_SIZE];
+    volatile uint8_t head;     // Next slot to write
+    volatile uint8_t tail;     // Oldest unread
+    volatile uint8_t count;    // Captures stored, read or not (saturates at the buffer size)
+    volatile uint16_t overflows;
+    volatile bool is_overrun;
+    bool is_both_edges;
+} TIM_IC_t;
+
+static TIM_IC_t capture = {0};
+
+TIM_handle_t *TIM_IC_init(TIM_IC_init_t *cfg) {
+    if (cfg->clk_source > TIM_CLK_INTERNAL_PRESCALER_DIV1024 || !TIM_prescaler_is_valid(TIM_1, cfg->clk_source)) return NULL;
+
+    TIM_init_t base_cfg = {
+        .timer        = TIM_1,
+        .clk_source   = cfg->clk_source,
+        .preset_value = 0,
+        .mode         = INPUT_CAPTURE,
+    };
+    TIM_handle_t *htim = TIM_base_init(&base_cfg);
+    if (htim == NULL) return NULL;
+
+    capture               = (TIM_IC_t){0};
+    capture.is_both_edges = cfg->edge == TIM_IC_EDGE_BOTH;
+
+    GPIO_config(GPIO_PORTB, GPIO_0, GPIO_INPUT);    // ICP1
+    TCCR1B = (cfg->noise_canceler ? (1 << ICNC1) : 0) | (cfg->edge == TIM_IC_EDGE_FALLING ? 0 : (1 << ICES1));
+    return htim;
+}
+
+void TIM_IC_start(TIM_handle_t *htim) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        capture.overflows = 0;
+        TCNT1             = 0;
+        TIFR1             = (1 << ICF1) | (1 << TOV1);    // Edges seen while stopped are stale
+        TIMSK1            = (1 << ICIE1) | (1 << TOIE1);
+        TIM_set_clk_source(htim);
     }
 }
-ISR(TIMER1_COMPB_vect) {
-    if (timer_handles[TIM_1].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_1].state = TIM_STATE_MATCH_B;
-        TIM_CTC_callback(&timer_handles[TIM_1]);
-        timer_handles[TIM_1].state = TIM_STATE_BUSY;
+
+void TIM_IC_stop(TIM_handle_t *htim) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIM_clear_clk_source(htim);
+        TIMSK1 &= ~(1 << ICIE1 | 1 << TOIE1);
     }
 }
 
-ISR(TIMER2_OVF_vect) {
-    if (timer_handles[TIM_2].state == TIM_STATE_BUSY) {
+uint8_t TIM_IC_available(TIM_handle_t *htim) {
+    return (uint8_t)(capture.head - capture.tail) & (2 * TIM_IC_BUFFER_SIZE - 1);
+}
+
+bool TIM_IC_read(TIM_handle_t *htim, TIM_IC_capture_t *dst) {
+    bool is_read = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (capture.head != capture.tail) {
+            *dst         = capture.buffer[capture.tail & TIM_IC_BUFFER_MSK];
+            capture.tail = (capture.tail + 1) & (2 * TIM_IC_BUFFER_SIZE - 1);
+            is_read      = true;
+        }
+    }
+    return is_read;
+}
+
+bool TIM_IC_has_overrun(TIM_handle_t *htim) {
+    bool is_overrun;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {    // An overrun set by the ISR in between is not lost
+        is_overrun         = capture.is_overrun;
+        capture.is_overrun = false;
+    }
+    return is_overrun;
+}
 
-        timer_handles[TIM_2].state = TIM_STATE_TIMEOUT;
-        TIM_period_elapsed_callback(&timer_handles[TIM_2]);
+// n = 0 is the newest capture. Called with interrupts disabled.
+static inline __attribute__((always_inline)) TIM_IC_capture_t *TIM_IC_peek(uint8_t n) {
+    return &capture.buffer[(uint8_t)(capture.head - 1 - n) & TIM_IC_BUFFER_MSK];
+}
 
-        if (timer_handles[TIM_2].config.mode == NORMAL_ONE_SHOT) {
-            TIM_base_stop_IT(&timer_handles[TIM_2]);
-        } else {
-            TIM_base_start(&timer_handles[TIM_2]);
+// Same edge to same edge: two captures back when both edges are captured
+bool TIM_IC_get_period_ticks(TIM_handle_t *htim, uint32_t *period_ticks) {
+    uint8_t distance = capture.is_both_edges ? 2 : 1;
+    bool is_valid    = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (capture.count > distance) {
+            *period_ticks = TIM_IC_peek(0)->timestamp - TIM_IC_peek(distance)->timestamp;
+            is_valid      = *period_ticks != 0;
+        }
+    }
+    return is_valid;
+}
+
+bool TIM_IC_get_frequency_cHz(TIM_handle_t *htim, uint32_t *frequency_cHz) {
+    uint32_t period;
+    if (!TIM_IC_get_period_ticks(htim, &period)) return false;
+
+    // F_CPU * 100 / (N * period) without overflowing 32 bits: divide by N first
+    uint32_t ticks_cHz = (TIM_F_CPU * 100UL) / TIM_get_prescaler_div(htim->config.clk_source);
+    *frequency_cHz     = (ticks_cHz + period / 2) / period;
+    return true;
+}
+
+bool TIM_IC_get_duty(TIM_handle_t *htim, uint16_t *duty) {
+    if (!capture.is_both_edges) return false;
+
+    uint32_t period = 0;
+    uint32_t high   = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (capture.count >= 3) {
+            TIM_IC_capture_t *newest = TIM_IC_peek(0);
+            TIM_IC_capture_t *middle = TIM_IC_peek(1);
+            TIM_IC_capture_t *oldest = TIM_IC_peek(2);
+            period                   = newest->timestamp - oldest->timestamp;
+            high                     = (newest->edge == TIM_IC_EDGE_FALLING) ? newest->timestamp - middle->timestamp
+                                                                             : middle->timestamp - oldest->timestamp;
+        }
+    }
+    if (period == 0) return false;
+
+    // Keep high * 2^15 within 32 bits
+    while (period > TIM_16B_MAX_VALUE) {
+        period >>= 1;
+        high >>= 1;
+    }
+    *duty = (uint16_t)((high * TIM_PWM_DUTY_MAX + period / 2) / period);
+    return true;
+}
+/* -------------------------------------------------------------------------- */
+
+/* ------------------------------ Tickless timer ----------------------------- */
+TIM_handle_t *TIM_tickless_init(void) {
+    TIM_init_t cfg = {
+        .timer        = TIM_1,
+        .clk_source   = TIM_TICKLESS_CLK_SOURCE,
+        .preset_value = 0,
+        .mode         = NORMAL_TICKLESS,
+    };
+    TIM_handle_t *htim = TIM_base_init(&cfg);
+    if (htim == NULL) return NULL;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tickless.overflows = 0;
+        tickless.ms        = 0;
+        tickless.rem_ticks = 0;
+        TCNT1              = 0;
+        TIFR1              = (1 << TOV1) | (1 << OCF1A);
+        TIMSK1             = (1 << TOIE1);
+        TIM_set_clk_source(htim);
+    }
+    return htim;
+}
+
+uint16_t TIM_tickless_get_tick_us(void) {
+    return TIM_TICKLESS_TICK_US;
+}
+
+uint32_t TIM_tickless_now(void) {
+    uint16_t high;
+    uint16_t low;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        high = tickless.overflows;
+        low  = TCNT1;
+        if ((TIFR1 & (1 << TOV1)) && low < 0x8000) high++;    // Overflow not serviced yet
+    }
+    return ((uint32_t)high << 16) | low;
+}
+
+void TIM_tickless_set_deadline(uint32_t deadline) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIFR1 = (1 << OCF1A);
+        do {
+            uint32_t now = TIM_tickless_now();
+            if ((int32_t)(deadline - now) < TIM_TICKLESS_MIN_TICKS) deadline = now + TIM_TICKLESS_MIN_TICKS;
+            OCR1A = (uint16_t)deadline;
+        } while ((int32_t)(deadline - TIM_tickless_now()) <= 0 && !(TIFR1 & (1 << OCF1A)));    // Passed while writing
+        tickless.deadline = deadline;
+        TIMSK1 |= (1 << OCIE1A);
+    }
+}
+
+void TIM_tickless_cancel(void) {
+    TIMSK1 &= ~(1 << OCIE1A);
+}
+
+/* Time base ---------------------------------- */
+uint32_t time_us(void) {
+    return TIM_tickless_now() * TIM_TICKLESS_TICK_US;    // Power of two on every board: compiles to shifts
+}
+
+uint32_t time_ms(void) {
+    uint32_t ms;
+    uint16_t rem;
+    uint16_t low;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms  = tickless.ms;
+        rem = tickless.rem_ticks;
+        low = TCNT1;
+        if ((TIFR1 & (1 << TOV1)) && low < 0x8000) {    // Overflow not serviced yet
+            ms += TIM_OVF_MS;
+            rem += TIM_OVF_REM_TICKS;
+        }
+    }
+
+    // Reciprocal multiply is at most one short, a single correction makes it exact
+    uint32_t ticks = (uint32_t)low + rem;
+    uint16_t q     = (ticks * TIM_MS_RECIPROCAL) >> TIM_MS_RECIPROCAL_SH;
+    if (ticks - (uint32_t)q * TIM_TICKS_PER_MS >= TIM_TICKS_PER_MS) q++;
+    return ms + q;
+}
+/* -------------------------------------------------------------------------- */
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+/* ---------------------------- CPU clock changes --------------------------- */
+// The prescaler of every timer in use moves by the same power of two as the CPU clock, so the
+// timer clock stays the same: presets, TOPs, PWM periods, captures and the tickless timestamp
+// keep their meaning. A change that a prescaler cannot follow is refused (DIV1..DIV1024 are
+// 2^0, 2^3, 2^6, 2^8 and 2^10, TIM_2 adds 2^5 and 2^7). Timers on the T0/T1 pins are not affected.
+static bool TIM_shift_to_clk_source(TIM_timer_t timer, int8_t shift, TIM_clk_source_t *clk_source) {
+    if (shift < 0 || shift > 10) return false;
+    for (uint8_t i = 0; i < TIM_N_PRESCALERS; i++) {
+        if (!TIM_prescaler_is_valid(timer, tim_prescalers[i].clk_source)) continue;
+        if ((1U << shift) == tim_prescalers[i].div) {
+            *clk_source = tim_prescalers[i].clk_source;
+            return true;
         }
     }
+    return false;
+}
+
+static bool TIM_clock_notifier(CLK_event_t event, clk_prescaler_t from, clk_prescaler_t to, void *ctx) {
+    for (uint8_t timer = TIM_0; timer <= TIM_2; timer++) {
+        TIM_handle_t *htim = &timer_handles[timer];
+        if (htim->is_available || htim->config.clk_source >= TIM_CLK_EXTERNAL_FALLING_EDGE) continue;
+
+        uint16_t div = TIM_get_prescaler_div(htim->config.clk_source);
+        int8_t shift = 0;
+        while ((1U << shift) < div) shift++;
+        shift -= (int8_t)to - (int8_t)from;
+
+        TIM_clk_source_t clk_source;
+        if (!TIM_shift_to_clk_source((TIM_timer_t)timer, shift, &clk_source)) return false;
+        if (event == CLK_PRE_CHANGE) continue;
+
+        htim->config.clk_source = clk_source;
+        htim->clk_bits          = TIM_get_clk_source_bits(htim);
+        if (*htim->regs.tccrb & NO_CLK_SOURCE_MSK) {    // Running
+            *htim->regs.tccrb = (*htim->regs.tccrb & ~NO_CLK_SOURCE_MSK) | htim->clk_bits;
+        }
+    }
+    return true;
+}
+/* -------------------------------------------------------------------------- */
+#endif
+
+#ifdef USE_TIMER_BENCHMARK
+/* -------------------------------- Benchmark ------------------------------- */
+bool TIM_benchmark_reload(TIM_benchmark_t *result) {
+    if (!timer_handles[TIM_0].is_available || !timer_handles[TIM_1].is_available) return false;
+
+    TIM_handle_t bench = {
+        .config = {.timer = TIM_0, .clk_source = TIM_CLK_INTERNAL_PRESCALER_DIV64, .preset_value = 6, .mode = NORMAL_TIMER_AUTORELOAD},
+    };
+    memcpy_P(&bench.regs, &tim_regs[TIM_0], sizeof(TIM_regs_t));
+    bench.clk_bits = TIM_get_clk_source_bits(&bench);
+
+    PWR_acquire(PWR_TIM0);    // Both timers are driven directly, without a handle
+    PWR_acquire(PWR_TIM1);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR1A = 0;
+        TCCR1B = (1 << CS10);    // One count per CPU cycle
+        TCNT1  = 0;
+
+        uint16_t start    = TCNT1;
+        uint16_t overhead = TCNT1 - start;
+
+        start = TCNT1;
+        TIM_base_start(&bench);
+        result->base_start_cycles = TCNT1 - start - overhead;
+
+        TCCR1B = 0;
+        TCNT1  = 0;
+        TCCR0B = 0;
+        TCNT0  = 0;
+        OCR0A  = 0;
+        TIFR0  = (1 << TOV0) | (1 << OCF0A);
+    }
+    PWR_release(PWR_TIM1);
+    PWR_release(PWR_TIM0);
+    return true;
+}
+/* -------------------------------------------------------------------------- */
+#endif
+
+/* -------------------------------- Callbacks ------------------------------- */
+// TODO: Agregar a cada COMPARE ISR el caso de output mode
+ISR(TIMER0_OVF_vect) {
+    if (timer_handles[TIM_0].pwm.is_update_pending) {
+        TIM_PWM_apply_const(&timer_handles[TIM_0], TIM_0);
+        return;
+    }
+    TIM_base_stop_IT_const(&timer_handles[TIM_0], TIM_0);    // Only NORMAL_ONE_SHOT uses the overflow, stopped first so the callback can restart it
+    TIM_dispatch(&timer_handles[TIM_0], TIM_EVENT_PERIOD_ELAPSED);
+}
+ISR(TIMER0_COMPA_vect) {
+    if (timer_handles[TIM_0].config.mode == NORMAL_TIMER_AUTORELOAD) {    // Already reloaded by hardware
+        TIM_dispatch(&timer_handles[TIM_0], TIM_EVENT_PERIOD_ELAPSED);
+        return;
+    }
+    TIM_dispatch(&timer_handles[TIM_0], TIM_EVENT_COMPARE_A);
+}
+ISR(TIMER0_COMPB_vect) {
+    TIM_dispatch(&timer_handles[TIM_0], TIM_EVENT_COMPARE_B);
+}
+
+ISR(TIMER1_OVF_vect) {
+    if (timer_handles[TIM_1].pwm.is_update_pending) {
+        TIM_PWM_apply_const(&timer_handles[TIM_1], TIM_1);
+        return;
+    }
+    if (timer_handles[TIM_1].config.mode == INPUT_CAPTURE) {
+        capture.overflows++;
+        return;
+    }
+    if (timer_handles[TIM_1].config.mode == NORMAL_TICKLESS) {
+        tickless.overflows++;
+        tickless.ms += TIM_OVF_MS;
+        tickless.rem_ticks += TIM_OVF_REM_TICKS;
+        if (tickless.rem_ticks >= TIM_TICKS_PER_MS) {
+            tickless.rem_ticks -= TIM_TICKS_PER_MS;
+            tickless.ms++;
+        }
+        return;
+    }
+    TIM_base_stop_IT_const(&timer_handles[TIM_1], TIM_1);    // Only NORMAL_ONE_SHOT uses the overflow, stopped first so the callback can restart it
+    TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_PERIOD_ELAPSED);
+}
+ISR(TIMER1_COMPA_vect) {
+    if (timer_handles[TIM_1].config.mode == NORMAL_TICKLESS) {
+        if ((int32_t)(TIM_tickless_now() - tickless.deadline) < 0) return;    // Low word matched in an earlier lap
+        TIMSK1 &= ~(1 << OCIE1A);
+        TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_DEADLINE);
+        return;
+    }
+    TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_COMPARE_A);
+}
+ISR(TIMER1_COMPB_vect) {
+    TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_COMPARE_B);
+}
+
+ISR(TIMER1_CAPT_vect) {
+    if (timer_handles[TIM_1].pwm.is_update_pending) {    // TOP of phase correct PWM
+        TIM_PWM_apply_const(&timer_handles[TIM_1], TIM_1);
+        return;
+    }
+    if (timer_handles[TIM_1].config.mode == NORMAL_TIMER_AUTORELOAD) {    // Already reloaded by hardware
+        TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_PERIOD_ELAPSED);
+        return;
+    }
+    uint16_t low  = ICR1;
+    uint8_t tccrb = TCCR1B;
+    uint16_t high = capture.overflows;
+    if ((TIFR1 & (1 << TOV1)) && low < 0x8000) high++;    // Overflow happened before the edge, not serviced yet
+
+    TIM_IC_capture_t *slot = &capture.buffer[capture.head & TIM_IC_BUFFER_MSK];
+    slot->timestamp        = ((uint32_t)high << 16) | low;
+    slot->edge             = (tccrb & (1 << ICES1)) ? TIM_IC_EDGE_RISING : TIM_IC_EDGE_FALLING;
+
+    if (capture.is_both_edges) {
+        TCCR1B = tccrb ^ (1 << ICES1);
+        TIFR1  = (1 << ICF1);    // Changing the edge may set ICF1
+    }
+
+    capture.head = (capture.head + 1) & (2 * TIM_IC_BUFFER_SIZE - 1);
+    if (capture.count < TIM_IC_BUFFER_SIZE) capture.count++;
+    if (TIM_IC_available(&timer_handles[TIM_1]) > TIM_IC_BUFFER_SIZE) {    // Full: drop the oldest
+        capture.tail       = (capture.tail + 1) & (2 * TIM_IC_BUFFER_SIZE - 1);
+        capture.is_overrun = true;
+    }
+    TIM_dispatch(&timer_handles[TIM_1], TIM_EVENT_CAPTURE);
+}
+
+ISR(TIMER2_OVF_vect) {
+    if (timer_handles[TIM_2].pwm.is_update_pending) {
+        TIM_PWM_apply_const(&timer_handles[TIM_2], TIM_2);
+        return;
+    }
+    TIM_base_stop_IT_const(&timer_handles[TIM_2], TIM_2);    // Only NORMAL_ONE_SHOT uses the overflow, stopped first so the callback can restart it
+    TIM_dispatch(&timer_handles[TIM_2], TIM_EVENT_PERIOD_ELAPSED);
 }
 ISR(TIMER2_COMPA_vect) {
-    if (timer_handles[TIM_2].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_2].state = TIM_STATE_MATCH_A;
-        TIM_CTC_callback(&timer_handles[TIM_2]);
-        timer_handles[TIM_2].state = TIM_STATE_BUSY;
+    if (timer_handles[TIM_2].config.mode == NORMAL_TIMER_AUTORELOAD) {    // Already reloaded by hardware
+        TIM_dispatch(&timer_handles[TIM_2], TIM_EVENT_PERIOD_ELAPSED);
+        return;
     }
+    TIM_dispatch(&timer_handles[TIM_2], TIM_EVENT_COMPARE_A);
 }
 ISR(TIMER2_COMPB_vect) {
-    if (timer_handles[TIM_2].state == TIM_STATE_BUSY) {
-        timer_handles[TIM_2].state = TIM_STATE_MATCH_B;
-        TIM_CTC_callback(&timer_handles[TIM_2]);
-        timer_handles[TIM_2].state = TIM_STATE_BUSY;
-    }
-}
\ No newline at end of file
+    TIM_dispatch(&timer_handles[TIM_2], TIM_EVENT_COMPARE_B);
+}
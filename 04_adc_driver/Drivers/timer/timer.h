@@ -15,6 +15,9 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include "../../board.h"
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Base config ------------------------------ */
@@ -48,6 +51,10 @@ typedef enum {
     CTC_CHANNEL_B_PIN_CLEAR,
     CTC_CHANNEL_A_PIN_SET,
     CTC_CHANNEL_B_PIN_SET,
+    NORMAL_TICKLESS,    // TIM_1 only, see TIM_tickless_init
+    PWM_FAST,
+    PWM_PHASE_CORRECT,
+    INPUT_CAPTURE,    // TIM_1 only, see TIM_IC_init
 } TIM_mode_t;
 
 /* Config datatype ---------------------------- */
@@ -69,6 +76,20 @@ typedef enum {
 struct TIM_handle;
 typedef struct TIM_handle TIM_handle_t;
 
+// Per handle callbacks, called straight from the ISR with the ctx given at registration
+typedef enum {
+    TIM_EVENT_PERIOD_ELAPSED,    // NORMAL_TIMER_AUTORELOAD period, NORMAL_ONE_SHOT end (already stopped)
+    TIM_EVENT_COMPARE_A,         // CTC channel A match
+    TIM_EVENT_COMPARE_B,         // CTC channel B match
+    TIM_EVENT_DEADLINE,          // NORMAL_TICKLESS, see TIM_tickless_set_deadline
+    TIM_EVENT_CAPTURE,           // INPUT_CAPTURE edge stored, read it with TIM_IC_read
+    TIM_N_EVENTS,
+} TIM_event_t;
+
+typedef void (*TIM_callback_t)(TIM_handle_t *htim, void *ctx);
+
+void TIM_register_callback(TIM_handle_t *htim, TIM_event_t event, TIM_callback_t callback, void *ctx);    // NULL unregisters
+
 TIM_state_t TIM_get_state(TIM_handle_t *htim);
 
 /* Base functions ----------------------------- */
@@ -80,7 +101,78 @@ void TIM_base_stop(TIM_handle_t *htim);
 void TIM_base_start_IT(TIM_handle_t *htim);
 void TIM_base_stop_IT(TIM_handle_t *htim);
 
+/* Period functions --------------------------- */
+// Fills cfg->clk_source and cfg->preset_value of cfg->timer for the NORMAL_TIMER_AUTORELOAD or
+// NORMAL_ONE_SHOT period closest to period_us: every prescaler of the timer is tried (TIM_2 adds
+// DIV32/DIV128) with its best TOP. Periods range from 1 CPU clock to MAX + 1 ticks at DIV1024
+// (~4.2 s on TIM_1, ~16 ms on TIM_0/TIM_2 at 16 MHz). Returns the achieved period in us, or 0
+// when it is out of range. The CPU clock is F_CLK_HZ >> CLKPS: with
+// USE_CPU_CLOCK_PRESCALER_AT_RUNTIME it is read from CLKPR, and the timers already in use are
+// kept at the same timer clock across clock_prescaler_config changes.
+uint32_t TIM_solve_period_us(TIM_init_t *cfg, uint32_t period_us);
+
+#if F_CLK_HZ % 1000000UL != 0
+#error "TIM period solver needs F_CLK_HZ in whole MHz"
+#endif
+#define TIM_CLK_MHZ       (F_CLK_HZ / 1000000UL)
+#define TIM_CPU_CLK_SHIFT ((F_CLK_HZ / F_CPU_HZ) == 8 ? 3 : 0)    // CKDIV8 fuse
+
+// Periods in F_CLK_HZ clocks: CPU clock and prescaler dividers are powers of two, so every
+// candidate is a shift and the errors of all prescalers compare in the same unit
+static inline __attribute__((always_inline)) uint32_t TIM_period_error(uint32_t a, uint32_t b) {
+    return (a > b) ? a - b : b - a;
+}
+
+static inline __attribute__((always_inline)) void TIM_period_try(TIM_init_t *cfg, uint32_t *best, uint32_t clocks,
+                                                                 uint8_t shift, TIM_clk_source_t clk_source) {
+    uint32_t max_ticks = (cfg->timer == TIM_1) ? 65536UL : 256UL;
+    uint32_t ticks     = (clocks + ((1UL << shift) >> 1)) >> shift;
+    if (ticks == 0) ticks = 1;
+    if (ticks > max_ticks) return;
+
+    uint32_t achieved = ticks << shift;
+    if (*best != 0 && TIM_period_error(achieved, clocks) >= TIM_period_error(*best, clocks)) return;    // Ties keep the finer steps
+
+    *best             = achieved;
+    cfg->clk_source   = clk_source;
+    cfg->preset_value = max_ticks - ticks;    // TOP = MAX - preset_value, period = TOP + 1
+}
+
+// Straight line instead of a loop over the prescaler table: constant arguments fold completely
+static inline __attribute__((always_inline)) uint32_t TIM_period_solve(TIM_init_t *cfg, uint32_t period_us, uint8_t cpu_shift) {
+    if (period_us == 0 || period_us > (UINT32_MAX / 2) / TIM_CLK_MHZ) return 0;
+
+    uint32_t clocks = period_us * TIM_CLK_MHZ;
+    uint32_t best   = 0;    // Achieved period, F_CLK_HZ clocks
+    TIM_period_try(cfg, &best, clocks, cpu_shift + 0, TIM_CLK_INTERNAL_PRESCALER_DIV1);
+    TIM_period_try(cfg, &best, clocks, cpu_shift + 3, TIM_CLK_INTERNAL_PRESCALER_DIV8);
+    if (cfg->timer == TIM_2) TIM_period_try(cfg, &best, clocks, cpu_shift + 5, TIM_CLK_INTERNAL_PRESCALER_DIV32);
+    TIM_period_try(cfg, &best, clocks, cpu_shift + 6, TIM_CLK_INTERNAL_PRESCALER_DIV64);
+    if (cfg->timer == TIM_2) TIM_period_try(cfg, &best, clocks, cpu_shift + 7, TIM_CLK_INTERNAL_PRESCALER_DIV128);
+    TIM_period_try(cfg, &best, clocks, cpu_shift + 8, TIM_CLK_INTERNAL_PRESCALER_DIV256);
+    TIM_period_try(cfg, &best, clocks, cpu_shift + 10, TIM_CLK_INTERNAL_PRESCALER_DIV1024);
+
+    return (best + TIM_CLK_MHZ / 2) / TIM_CLK_MHZ;    // 0 when no prescaler fits
+}
+
+// NORMAL_TIMER_AUTORELOAD timer with the closest period, NULL when it is out of range or the
+// timer is in use. achieved_us (optional) receives the period actually programmed.
+static inline __attribute__((always_inline)) TIM_handle_t *TIM_init_period_us(TIM_timer_t timer, uint32_t period_us,
+                                                                              uint32_t *achieved_us) {
+    TIM_init_t cfg = {.timer = timer, .mode = NORMAL_TIMER_AUTORELOAD};
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    uint32_t achieved = TIM_solve_period_us(&cfg, period_us);
+#else
+    uint32_t achieved = (__builtin_constant_p(timer) && __builtin_constant_p(period_us))
+                            ? TIM_period_solve(&cfg, period_us, TIM_CPU_CLK_SHIFT)
+                            : TIM_solve_period_us(&cfg, period_us);
+#endif
+    if (achieved_us != NULL) *achieved_us = achieved;
+    return (achieved != 0) ? TIM_base_init(&cfg) : NULL;
+}
+
 /* CTC functions ----------------------------- */
+// The CTC_CHANNEL_x_PIN_x modes drive OCxA/OCxB on compare match, the pin is made an output (low)
 TIM_handle_t *TIM_CTC_init(TIM_init_t *cfg);
 
 void TIM_CTC_A_start(TIM_handle_t *htim);
@@ -95,8 +187,104 @@ void TIM_CTC_A_stop_IT(TIM_handle_t *htim);
 void TIM_CTC_B_start_IT(TIM_handle_t *htim);
 void TIM_CTC_B_stop_IT(TIM_handle_t *htim);
 
-/* Callbacks ------------------------------- */
-extern void TIM_period_elapsed_callback(TIM_handle_t *htim);
-extern void TIM_CTC_callback(TIM_handle_t *htim);
+/* PWM functions ----------------------------- */
+// TIM_0/TIM_2: 8 bit (TOP = 0xFF), the prescaler closest to the requested frequency is used.
+// TIM_1: 16 bit (TOP = ICR1), the smallest prescaler that fits gives the finest duty steps.
+// Duty and frequency changes are staged and applied together at the next overflow interrupt,
+// so a period is never cut short and both channels switch in the same period.
+#define TIM_PWM_DUTY_MAX          0x8000U    // Duty is Q1.15: 0x8000 = 100%
+#define TIM_PWM_DUTY_PERCENT(pct) ((uint16_t)(((uint32_t)(pct) * TIM_PWM_DUTY_MAX) / 100U))
+
+typedef enum {
+    TIM_PWM_CHANNEL_A,
+    TIM_PWM_CHANNEL_B,
+} TIM_PWM_channel_t;
+
+#define TIM_PWM_OUTPUT_A (1 << TIM_PWM_CHANNEL_A)
+#define TIM_PWM_OUTPUT_B (1 << TIM_PWM_CHANNEL_B)
+
+typedef struct {
+    TIM_timer_t timer;
+    TIM_mode_t mode;           // PWM_FAST or PWM_PHASE_CORRECT
+    uint32_t frequency_cHz;    // Centi-hertz
+    uint8_t outputs;           // TIM_PWM_OUTPUT_x: OCxA/OCxB pins configured through the GPIO driver
+} TIM_PWM_init_t;
+
+TIM_handle_t *TIM_PWM_init(TIM_PWM_init_t *cfg);
+
+void TIM_PWM_start(TIM_handle_t *htim);
+void TIM_PWM_stop(TIM_handle_t *htim);    // Outputs are disconnected and driven low
+
+void TIM_PWM_set_duty(TIM_handle_t *htim, TIM_PWM_channel_t channel, uint16_t duty);
+bool TIM_PWM_set_frequency_cHz(TIM_handle_t *htim, uint32_t frequency_cHz);    // TIM_1 only
+uint32_t TIM_PWM_get_frequency_cHz(TIM_handle_t *htim);                        // Achieved frequency
+
+/* Input capture functions ------------------- */
+// TIM_1 runs free and every edge on ICP1 (PB0) latches TCNT1 in hardware. Captures are
+// extended to 32 bits with the overflow count and queued in a ring buffer.
+// Each capture also raises ICF1, the ADC_TIMER1_CAPTURE_EVENT auto trigger source.
+#ifndef TIM_IC_BUFFER_SIZE
+#define TIM_IC_BUFFER_SIZE 16    // Power of two
+#endif
+
+typedef enum {
+    TIM_IC_EDGE_FALLING,
+    TIM_IC_EDGE_RISING,
+    TIM_IC_EDGE_BOTH,    // Needed for the duty cycle
+} TIM_IC_edge_t;
+
+typedef struct {
+    TIM_clk_source_t clk_source;    // Internal prescalers only
+    TIM_IC_edge_t edge;
+    bool noise_canceler;    // Edge must be stable for 4 timer clocks (adds 4 clocks of delay)
+} TIM_IC_init_t;
+
+typedef struct {
+    uint32_t timestamp;    // Timer ticks
+    TIM_IC_edge_t edge;    // TIM_IC_EDGE_FALLING or TIM_IC_EDGE_RISING
+} TIM_IC_capture_t;
+
+TIM_handle_t *TIM_IC_init(TIM_IC_init_t *cfg);
+
+void TIM_IC_start(TIM_handle_t *htim);
+void TIM_IC_stop(TIM_handle_t *htim);
+
+uint8_t TIM_IC_available(TIM_handle_t *htim);
+bool TIM_IC_read(TIM_handle_t *htim, TIM_IC_capture_t *capture);    // Oldest unread capture
+bool TIM_IC_has_overrun(TIM_handle_t *htim);                        // Unread captures were overwritten (clears)
+
+// From the newest captures (read or not). False until enough edges were captured.
+bool TIM_IC_get_period_ticks(TIM_handle_t *htim, uint32_t *period_ticks);
+bool TIM_IC_get_frequency_cHz(TIM_handle_t *htim, uint32_t *frequency_cHz);
+bool TIM_IC_get_duty(TIM_handle_t *htim, uint16_t *duty);    // Q1.15, needs TIM_IC_EDGE_BOTH
+
+/* Tickless functions ------------------------ */
+// TIM_1 runs free and its overflows extend TCNT1 to a 32 bit timestamp. Instead of a
+// periodic tick, OCR1A is programmed to the next deadline: TIM_EVENT_DEADLINE only
+// runs when something is due and the CPU can sleep in between.
+TIM_handle_t *TIM_tickless_init(void);
+uint16_t TIM_tickless_get_tick_us(void);    // Timestamp resolution
+
+uint32_t TIM_tickless_now(void);
+void TIM_tickless_set_deadline(uint32_t deadline);    // Absolute timestamp, a past one fires as soon as possible
+void TIM_tickless_cancel(void);
+
+/* Time base -------------------------------- */
+// Monotonic time from the tickless TIM_1 timestamp (valid after TIM_tickless_init).
+// Both are consistent with an overflow pending in TIFR1 and safe to call from ISRs.
+uint32_t time_us(void);    // TIM_tickless_get_tick_us resolution, wraps every ~71 minutes
+uint32_t time_ms(void);    // Wraps every ~49 days
+
+#ifdef USE_TIMER_BENCHMARK
+/* Benchmark ---------------------------------- */
+// CPU cycles of TIM_base_start (autoreload, runtime timer id), measured with TIM_1 at F_CPU
+// on a TIM_0 dummy handle. Both timers must be free (run it before initializing them).
+// The autoreload ISR itself no longer restarts the timer: its cost is the callback dispatch.
+typedef struct {
+    uint16_t base_start_cycles;
+} TIM_benchmark_t;
+
+bool TIM_benchmark_reload(TIM_benchmark_t *result);
+#endif
 
 #endif    // TIMER_H
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "../../../02_driver_timer/Drivers/uart/uart.h"
 #include "../../board.h"
+#include "../clock/clock.h"
+#include "../power/power.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
@@ -11,7 +13,44 @@ static int UART_read_byte(FILE *stream);
 static FILE UART_stdin  = FDEV_SETUP_STREAM(NULL, UART_read_byte, _FDEV_SETUP_READ);
 static FILE UART_stdout = FDEV_SETUP_STREAM(UART_write_byte, NULL, _FDEV_SETUP_WRITE);
 
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+#define UART_BAUD_TOLERANCE_PERMILLE 20U    // Both ends together stay within the frame tolerance
+
+static bool uart_tx_started = false;    // TXC0 is only meaningful once a byte was sent
+
+// Double speed for the finest UBRR steps at the lower clocks
+static uint16_t UART_get_ubrr(uint32_t f_cpu_hz) {
+    return (f_cpu_hz + 4UL * BAUD) / (8UL * BAUD) - 1;
+}
+
+// Refuses a clock whose closest baud rate is off by more than the tolerance (below ~1 MHz at
+// 9600). The pending byte is shifted out at the old rate before the clock changes; a byte being
+// received at that moment is lost.
+static bool UART_clock_notifier(CLK_event_t event, clk_prescaler_t from, clk_prescaler_t to, void *ctx) {
+    uint32_t f_cpu_hz = F_CLK_HZ >> to;
+    if (f_cpu_hz < 16UL * BAUD) return false;
+    uint16_t ubrr = UART_get_ubrr(f_cpu_hz);
+
+    if (event == CLK_PRE_CHANGE) {
+        uint32_t baud  = f_cpu_hz / (8UL * (ubrr + 1));
+        uint32_t error = (baud > BAUD) ? baud - BAUD : BAUD - baud;
+        if (error * 1000UL > BAUD * (uint32_t)UART_BAUD_TOLERANCE_PERMILLE) return false;
+        if (uart_tx_started) loop_until_bit_is_set(UCSR0A, TXC0);
+        return true;
+    }
+
+    UCSR0A = (1 << U2X0);    // No read-modify-write: writing back the set TXC0 would clear it
+    UBRR0  = ubrr;
+    return true;
+}
+#endif
+
 void UART_init(void) {
+    static bool is_acquired = false;    // UART_init may be called again, the USART has a single user
+    if (!is_acquired) {
+        PWR_acquire(PWR_USART0);
+        is_acquired = true;
+    }
     UBRR0H = UBRRH_VALUE;    // Mirar setbaud.h
     UBRR0L = UBRRL_VALUE;
 #if USE_2X
@@ -24,6 +63,11 @@ void UART_init(void) {
 
     stdin  = &UART_stdin;
     stdout = &UART_stdout;
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    UART_clock_notifier(CLK_POST_CHANGE, clock_get_prescaler(), clock_get_prescaler(), NULL);    // Clock may differ from F_CPU
+    clock_register_notifier(UART_clock_notifier, NULL);
+#endif
 }
 
 // void UART_IT_init(void) {
@@ -38,7 +82,11 @@ bool UART_is_available(void) {
 
 static int UART_write_byte(char write_byte, FILE *stream) {
     loop_until_bit_is_set(UCSR0A, UDRE0);    // Wait for empty transmit buffer
-    UDR0 = write_byte;                       // write one byte to UART0
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    UCSR0A |= (1 << TXC0);    // Cleared by writing 1: set again once this byte is shifted out
+    uart_tx_started = true;
+#endif
+    UDR0 = write_byte;    // write one byte to UART0
     return 0;
 }
 
@@ -61,16 +61,14 @@
 // Useful for AVR Delay
 #endif
 
-#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
-static float f_cpu_hz = F_CPU_HZ;
-// #undef F_CPU_HZ
-#endif
-
 /* -------------------------- Hardware peripherals -------------------------- */
 
 // CPU Prescaler -----------------------------
 // #define USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
 
+// Power -------------------------------------
+#define USE_POWER    // Peripheral clocks (PRR) only run while a driver uses them
+
 // GPIO --------------------------------------
 #define USE_GPIO
 
@@ -83,5 +81,17 @@ static float f_cpu_hz = F_CPU_HZ;
 
 // TIM ---------------------------------------
 #define USE_TIMER
+// #define USE_TIMER_BENCHMARK    // Prints the cycles of the timer reload path at boot
+
+// EEPROM ------------------------------------
+#define USE_EEPROM
+
+/* -------------------------------- Libraries ------------------------------- */
+
+// Scheduler ---------------------------------
+// #define USE_SCH_STATS    // Per task timing and CPU load (lib/scheduler), needs the TIM_1 tickless timestamp
+
+// Kernel ------------------------------------
+// #define USE_KERNEL    // Preemptive kernel (lib/kernel), owns TIM_2 for the tick
 
 #endif    // BOARD_H
\ No newline at end of file
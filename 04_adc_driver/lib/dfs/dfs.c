@@ -0,0 +1,62 @@
+/**
+ * @file dfs.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-19
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "dfs.h"
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+
+static DFS_init_t dfs_cfg   = {.fast = CLK_DIV_1, .slow = CLK_DIV_1};
+static uint8_t dfs_requests = 0;
+
+// First level from `from` toward `to` (both included) that every notifier accepts
+static void DFS_set(clk_prescaler_t from, clk_prescaler_t to) {
+    int8_t step = (to >= from) ? 1 : -1;
+    for (int8_t level = from;; level += step) {
+        if (clock_prescaler_config((clk_prescaler_t)level) || level == (int8_t)to) return;
+    }
+}
+
+bool DFS_init(DFS_init_t *cfg) {
+    if (cfg->fast > cfg->slow || cfg->slow > CLK_DIV_256 || cfg->down_permille >= cfg->up_permille) return false;
+    dfs_cfg      = *cfg;
+    dfs_requests = 0;
+    DFS_set(dfs_cfg.slow, dfs_cfg.fast);    // As slow as the drivers in use allow
+    return true;
+}
+
+void DFS_update(uint16_t load_permille) {
+    if (dfs_requests) return;
+
+    clk_prescaler_t current = clock_get_prescaler();
+    if (load_permille > dfs_cfg.up_permille && current != dfs_cfg.fast) {
+        DFS_set(dfs_cfg.fast, current);
+    } else if (load_permille < dfs_cfg.down_permille && current < dfs_cfg.slow) {
+        DFS_set(current + 1, dfs_cfg.slow);
+    }
+}
+
+void DFS_request(void) {
+    if (dfs_requests++ == 0) DFS_set(dfs_cfg.fast, clock_get_prescaler());
+}
+
+void DFS_release(void) {
+    if (dfs_requests == 0) return;
+    if (--dfs_requests == 0) DFS_set(dfs_cfg.slow, dfs_cfg.fast);
+}
+
+clk_prescaler_t DFS_get_prescaler(void) {
+    return clock_get_prescaler();
+}
+
+#endif
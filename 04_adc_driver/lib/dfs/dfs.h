@@ -0,0 +1,48 @@
+/**
+ * @file dfs.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-19
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef DFS_H
+#define DFS_H
+
+#include "../../Drivers/clock/clock.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+
+// Dynamic frequency scaling governor on the CPU clock prescaler: full speed while a burst is
+// requested or the load is high, slow otherwise. Every change goes through
+// clock_prescaler_config, so the driver notifiers retime their peripherals (or refuse a clock
+// they cannot follow: that level is skipped). Task context only, never from an ISR: a change
+// waits for the UART to finish the byte it is sending.
+typedef struct {
+    clk_prescaler_t fast;      // Bursts and high load, e.g. CLK_DIV_1
+    clk_prescaler_t slow;      // Low load, e.g. CLK_DIV_8
+    uint16_t up_permille;      // Load above it: straight to fast
+    uint16_t down_permille;    // Load below it: one level toward slow per update
+} DFS_init_t;
+
+bool DFS_init(DFS_init_t *cfg);    // Starts at slow
+
+// Load of the last window, from a periodic task (e.g. SCH_stats_get_load_permille and a reset)
+void DFS_update(uint16_t load_permille);
+
+void DFS_request(void);    // Full speed until the matching DFS_release, reference counted
+void DFS_release(void);
+
+clk_prescaler_t DFS_get_prescaler(void);
+
+#endif
+
+#endif    // DFS_H
@@ -0,0 +1,328 @@
+/**
+ * @file kernel.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-09
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "kernel.h"
+
+#ifdef USE_KERNEL
+
+#include "../../Drivers/timer/timer.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
+#include <util/atomic.h>
+
+#if KRN_MAX_TASKS > 7
+#error "KRN_MAX_TASKS plus the idle task must fit the 8 bit ready mask"
+#endif
+
+#define KRN_IDLE        KRN_MAX_TASKS    // Lowest priority, runs on the main() stack
+#define KRN_SWITCH_REGS 18U              // r2-r17, r28, r29
+
+struct KRN_tcb {
+    uint16_t sp;                // Must stay first: KRN_switch reads it at offset 0
+    volatile uint16_t delay;    // Ticks left of a delay or timeout, 0 = none
+    uint8_t mask;               // 1 << priority
+    KRN_task_fn_t function;
+    void *ctx;
+};
+
+static KRN_task_t krn_tcbs[KRN_MAX_TASKS + 1] = {[KRN_IDLE] = {.mask = (1 << KRN_IDLE)}};
+KRN_task_t *volatile krn_current __attribute__((used)) = &krn_tcbs[KRN_IDLE];    // Used by KRN_switch
+
+static volatile uint8_t krn_ready = (1 << KRN_IDLE);
+static volatile uint32_t krn_ticks = 0;
+
+/* ----------------------------- Context switch ----------------------------- */
+// Highest priority ready task (the idle task is always ready)
+__attribute__((used)) void KRN_select(void) {
+    uint8_t ready   = krn_ready;
+    KRN_task_t *tcb = krn_tcbs;
+    while (!(ready & 1)) {
+        ready >>= 1;
+        tcb++;
+    }
+    krn_current = tcb;
+}
+
+// Interrupts disabled. ~130 cycles from the call to the ret (~8 us at 16 MHz)
+__attribute__((naked, noinline)) static void KRN_switch(void) {
+    __asm__ __volatile__(
+        "push r2                 \n\t"
+        "push r3                 \n\t"
+        "push r4                 \n\t"
+        "push r5                 \n\t"
+        "push r6                 \n\t"
+        "push r7                 \n\t"
+        "push r8                 \n\t"
+        "push r9                 \n\t"
+        "push r10                \n\t"
+        "push r11                \n\t"
+        "push r12                \n\t"
+        "push r13                \n\t"
+        "push r14                \n\t"
+        "push r15                \n\t"
+        "push r16                \n\t"
+        "push r17                \n\t"
+        "push r28                \n\t"
+        "push r29                \n\t"
+        "lds  r30, krn_current   \n\t"
+        "lds  r31, krn_current+1 \n\t"
+        "in   r0, __SP_L__       \n\t"
+        "st   Z, r0              \n\t"
+        "in   r0, __SP_H__       \n\t"
+        "std  Z+1, r0            \n\t"
+        "call KRN_select         \n\t"
+        "lds  r30, krn_current   \n\t"
+        "lds  r31, krn_current+1 \n\t"
+        "ld   r0, Z              \n\t"
+        "out  __SP_L__, r0       \n\t"
+        "ldd  r0, Z+1            \n\t"
+        "out  __SP_H__, r0       \n\t"
+        "pop  r29                \n\t"
+        "pop  r28                \n\t"
+        "pop  r17                \n\t"
+        "pop  r16                \n\t"
+        "pop  r15                \n\t"
+        "pop  r14                \n\t"
+        "pop  r13                \n\t"
+        "pop  r12                \n\t"
+        "pop  r11                \n\t"
+        "pop  r10                \n\t"
+        "pop  r9                 \n\t"
+        "pop  r8                 \n\t"
+        "pop  r7                 \n\t"
+        "pop  r6                 \n\t"
+        "pop  r5                 \n\t"
+        "pop  r4                 \n\t"
+        "pop  r3                 \n\t"
+        "pop  r2                 \n\t"
+        "ret                     \n\t");
+}
+
+// Interrupts disabled. A ready bit below the current one is a higher priority task
+static inline __attribute__((always_inline)) void KRN_preempt(void) {
+    if (krn_ready & (krn_current->mask - 1)) KRN_switch();
+}
+
+// First return of KRN_switch into a task
+static void KRN_task_entry(void) {
+    sei();
+    krn_current->function(krn_current->ctx);
+
+    cli();
+    krn_ready &= ~krn_current->mask;    // Ended: never selected again
+    KRN_switch();
+}
+
+// Interrupts disabled. Highest priority task of a waiting mask becomes ready, true if it
+// preempts the current one
+static bool KRN_wake_one(volatile uint8_t *waiting) {
+    uint8_t bit = *waiting & -*waiting;
+    if (bit == 0) return false;
+
+    *waiting &= ~bit;
+    krn_ready |= bit;
+    for (KRN_task_t *tcb = krn_tcbs; tcb < &krn_tcbs[KRN_IDLE]; tcb++) {
+        if (tcb->mask == bit) tcb->delay = 0;
+    }
+    return bit < krn_current->mask;
+}
+
+// Interrupts disabled. Blocks the current task on a waiting mask, false on timeout
+static bool KRN_block(volatile uint8_t *waiting, uint16_t timeout_ticks) {
+    uint8_t bit = krn_current->mask;
+    *waiting |= bit;
+    krn_ready &= ~bit;
+    krn_current->delay = (timeout_ticks == KRN_FOREVER) ? 0 : timeout_ticks;
+    KRN_switch();
+
+    if (!(*waiting & bit)) return true;
+    *waiting &= ~bit;    // Still waiting: woken by the tick
+    return false;
+}
+
+// ISR context: switch after the driver ISR returned, on the COMPB match of the tick timer
+static void KRN_pend_switch(void) {
+    uint16_t match = TCNT2 + 2;    // A TCNT2 write would block the next match, OCR2B does not
+    if (match > OCR2A) match -= OCR2A + 1;
+    OCR2B = match;
+    TIFR2 = (1 << OCF2B);
+    TIMSK2 |= (1 << OCIE2B);
+}
+/* -------------------------------------------------------------------------- */
+
+/* ------------------------------ Tick and pend ----------------------------- */
+static void KRN_tick(TIM_handle_t *htim, void *ctx) {
+    krn_ticks++;
+    for (KRN_task_t *tcb = krn_tcbs; tcb < &krn_tcbs[KRN_IDLE]; tcb++) {
+        if (tcb->delay && --tcb->delay == 0) krn_ready |= tcb->mask;
+    }
+    KRN_preempt();
+}
+
+static void KRN_pend_callback(TIM_handle_t *htim, void *ctx) {
+    TIMSK2 &= ~(1 << OCIE2B);
+    KRN_preempt();
+}
+/* -------------------------------------------------------------------------- */
+
+KRN_task_t *KRN_task_create(KRN_task_init_t *cfg) {
+    if (cfg->function == NULL || cfg->priority >= KRN_MAX_TASKS || cfg->stack_size < KRN_STACK_MIN) return NULL;
+
+    KRN_task_t *tcb = &krn_tcbs[cfg->priority];
+    if (tcb->mask != 0) return NULL;
+
+    // Frame popped by KRN_switch: call saved registers, then the return address (high byte first)
+    uint8_t *sp    = cfg->stack + cfg->stack_size - 1;
+    uint16_t entry = (uint16_t)KRN_task_entry;
+    *sp--          = entry & 0xFF;
+    *sp--          = entry >> 8;
+    for (uint8_t i = 0; i < KRN_SWITCH_REGS; i++) {
+        *sp-- = 0;
+    }
+
+    tcb->sp       = (uint16_t)sp;
+    tcb->delay    = 0;
+    tcb->function = cfg->function;
+    tcb->ctx      = cfg->ctx;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tcb->mask = (1 << cfg->priority);
+        krn_ready |= tcb->mask;
+    }
+    return tcb;
+}
+
+bool KRN_start(uint32_t tick_us) {
+    TIM_handle_t *htim = TIM_init_period_us(TIM_2, tick_us, NULL);
+    if (htim == NULL) return false;
+
+    TIM_register_callback(htim, TIM_EVENT_PERIOD_ELAPSED, KRN_tick, NULL);
+    TIM_register_callback(htim, TIM_EVENT_COMPARE_B, KRN_pend_callback, NULL);
+
+    ATOMIC_BLOCK(ATOMIC_FORCEON) {
+        TIM_base_start_IT(htim);
+        KRN_switch();    // To the highest priority task, back here when only idle is ready
+    }
+    return true;
+}
+
+void KRN_delay(uint16_t ticks) {
+    if (ticks == 0) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        krn_current->delay = ticks;
+        krn_ready &= ~krn_current->mask;
+        KRN_switch();
+    }
+}
+
+void KRN_yield(void) {    // Only a higher priority task can take over
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        KRN_preempt();
+    }
+}
+
+uint32_t KRN_get_ticks(void) {
+    uint32_t ticks;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = krn_ticks;
+    }
+    return ticks;
+}
+
+/* ---------------------------- Binary semaphore ---------------------------- */
+bool KRN_sem_take(KRN_sem_t *sem, uint16_t timeout_ticks) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (sem->count) {
+            sem->count = 0;
+            return true;
+        }
+        if (timeout_ticks == KRN_NO_WAIT) return false;
+        return KRN_block(&sem->waiting, timeout_ticks);    // The give hands it over directly
+    }
+    return false;
+}
+
+void KRN_sem_give(KRN_sem_t *sem) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (sem->waiting == 0) {
+            sem->count = 1;
+        } else if (KRN_wake_one(&sem->waiting)) {
+            KRN_switch();
+        }
+    }
+}
+
+void KRN_sem_give_from_ISR(KRN_sem_t *sem) {
+    if (sem->waiting == 0) {
+        sem->count = 1;
+    } else if (KRN_wake_one(&sem->waiting)) {
+        KRN_pend_switch();
+    }
+}
+/* -------------------------------------------------------------------------- */
+
+/* ---------------------------------- Queue --------------------------------- */
+void KRN_queue_init(KRN_queue_t *queue, void *buffer, uint8_t item_size, uint8_t length) {
+    queue->buffer     = buffer;
+    queue->item_size  = item_size;
+    queue->length     = length;
+    queue->head       = 0;
+    queue->count      = 0;
+    queue->rx_waiting = 0;
+    queue->tx_waiting = 0;
+}
+
+// Interrupts disabled
+static bool KRN_queue_push(KRN_queue_t *queue, const void *item) {
+    if (queue->count == queue->length) return false;
+    uint8_t tail = queue->head + queue->count;
+    if (tail >= queue->length) tail -= queue->length;
+    memcpy(&queue->buffer[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+    return true;
+}
+
+bool KRN_queue_send(KRN_queue_t *queue, const void *item, uint16_t timeout_ticks) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while (!KRN_queue_push(queue, item)) {
+            if (timeout_ticks == KRN_NO_WAIT || !KRN_block(&queue->tx_waiting, timeout_ticks)) return false;
+        }
+        if (KRN_wake_one(&queue->rx_waiting)) KRN_switch();
+    }
+    return true;
+}
+
+bool KRN_queue_receive(KRN_queue_t *queue, void *item, uint16_t timeout_ticks) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while (queue->count == 0) {
+            if (timeout_ticks == KRN_NO_WAIT || !KRN_block(&queue->rx_waiting, timeout_ticks)) return false;
+        }
+        memcpy(item, &queue->buffer[queue->head * queue->item_size], queue->item_size);
+        queue->head = (queue->head + 1 == queue->length) ? 0 : queue->head + 1;
+        queue->count--;
+        if (KRN_wake_one(&queue->tx_waiting)) KRN_switch();
+    }
+    return true;
+}
+
+bool KRN_queue_send_from_ISR(KRN_queue_t *queue, const void *item) {
+    if (!KRN_queue_push(queue, item)) return false;
+    if (KRN_wake_one(&queue->rx_waiting)) KRN_pend_switch();
+    return true;
+}
+/* -------------------------------------------------------------------------- */
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file kernel.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-09
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "../../board.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef USE_KERNEL
+
+// Fixed priority preemptive kernel, one task per priority (0 is the highest). TIM_2 gives the
+// tick through the timer driver callbacks and is owned by the kernel: its COMPB match is also
+// armed to switch a couple of timer clocks after an ISR woke a higher priority task, once the
+// driver ISR has fully returned. After KRN_start, main() continues as the idle task: it must
+// never block (sleeping with the interrupts enabled is fine).
+// The context switch saves only r2-r17/r28/r29: it is always reached through a function call,
+// so the compiler (task code) or the ISR prologue (tick) already saved the call used registers.
+#ifndef KRN_MAX_TASKS
+#define KRN_MAX_TASKS 4    // Plus the idle task
+#endif
+
+// Every stack also takes the frames of the ISRs (and their callbacks) that interrupt its task
+#define KRN_STACK_MIN 96U
+
+#define KRN_NO_WAIT 0
+#define KRN_FOREVER 0xFFFFU
+
+// Stack sized at compile time: KRN_TASK_STACK(adc_stack, 128);
+#define KRN_TASK_STACK(name, size)                                               \
+    _Static_assert((size) >= KRN_STACK_MIN, "KRN stack " #name " is too small"); \
+    static uint8_t name[(size)]
+
+struct KRN_tcb;
+typedef struct KRN_tcb KRN_task_t;
+
+typedef void (*KRN_task_fn_t)(void *ctx);
+
+typedef struct {
+    KRN_task_fn_t function;    // Returning ends the task
+    void *ctx;
+    uint8_t priority;    // 0 (highest) to KRN_MAX_TASKS - 1, one task per level
+    uint8_t *stack;
+    uint16_t stack_size;    // sizeof of the KRN_TASK_STACK array
+} KRN_task_init_t;
+
+KRN_task_t *KRN_task_create(KRN_task_init_t *cfg);    // Before KRN_start
+
+// TIM_2 tick period (TIM_init_period_us). Returns in the idle task, false if TIM_2 is in use
+bool KRN_start(uint32_t tick_us);
+
+void KRN_delay(uint16_t ticks);
+void KRN_yield(void);
+uint32_t KRN_get_ticks(void);
+
+/* Binary semaphore --------------------------- */
+typedef struct {
+    volatile uint8_t count;      // 0 or 1
+    volatile uint8_t waiting;    // Priority mask of the blocked tasks
+} KRN_sem_t;
+
+#define KRN_SEM_INIT(initial) {.count = (initial) ? 1 : 0, .waiting = 0}
+
+bool KRN_sem_take(KRN_sem_t *sem, uint16_t timeout_ticks);
+void KRN_sem_give(KRN_sem_t *sem);
+void KRN_sem_give_from_ISR(KRN_sem_t *sem);    // From driver callbacks (ADC EOC, GPIO EXTI, ...)
+
+/* Queue -------------------------------------- */
+// Items are copied in and out of a buffer of length * item_size bytes given by the user
+typedef struct {
+    uint8_t *buffer;
+    uint8_t item_size;
+    uint8_t length;
+    volatile uint8_t head;
+    volatile uint8_t count;
+    volatile uint8_t rx_waiting;    // Priority mask of the blocked tasks
+    volatile uint8_t tx_waiting;
+} KRN_queue_t;
+
+void KRN_queue_init(KRN_queue_t *queue, void *buffer, uint8_t item_size, uint8_t length);
+
+bool KRN_queue_send(KRN_queue_t *queue, const void *item, uint16_t timeout_ticks);
+bool KRN_queue_receive(KRN_queue_t *queue, void *item, uint16_t timeout_ticks);
+bool KRN_queue_send_from_ISR(KRN_queue_t *queue, const void *item);    // False when full
+
+#endif
+
+#endif    // KERNEL_H
@@ -0,0 +1,277 @@
+/**
+ * @file scheduler.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "scheduler.h"
+#include "../../Drivers/timer/soft_timer.h"
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stddef.h>
+#include <util/atomic.h>
+
+#ifdef USE_SCH_STATS
+#include "../../Drivers/timer/timer.h"
+#include <stdio.h>
+#endif
+
+#if SCH_MAX_TASKS > 8
+#error "SCH_MAX_TASKS must fit the 8 bit ready mask"
+#endif
+
+struct SCH_task {
+    SCH_task_fn_t function;
+    void *ctx;
+    SWTIM_timer_t *timer;    // NULL for SCH_EVENT
+    uint8_t mask;            // Ready bit, 1 << priority
+#ifdef USE_SCH_STATS
+    volatile uint32_t released_at;    // Timestamp of the pending release
+    volatile uint32_t misses;
+    uint32_t runs;
+    uint32_t exec_min;
+    uint32_t exec_max;
+    uint32_t exec_sum;
+    uint32_t latency_min;
+    uint32_t latency_max;
+#endif
+};
+
+static SCH_task_t *sch_tasks[SCH_MAX_TASKS] = {NULL};    // Indexed by priority
+static SCH_task_t sch_pool[SCH_MAX_TASKS];
+static volatile uint8_t sch_ready = 0;
+
+#ifdef USE_SCH_STATS
+static SCH_task_t *volatile sch_running = NULL;    // Read by the release ISRs
+static uint32_t sch_window_start;
+static uint32_t sch_idle_ticks;
+
+static void SCH_stats_task_reset(SCH_task_t *task) {
+    task->misses      = 0;
+    task->runs        = 0;
+    task->exec_min    = UINT32_MAX;
+    task->exec_max    = 0;
+    task->exec_sum    = 0;
+    task->latency_min = UINT32_MAX;
+    task->latency_max = 0;
+}
+
+// Interrupts disabled
+static inline __attribute__((always_inline)) void SCH_stats_release(SCH_task_t *task) {
+    if ((sch_ready & task->mask) || sch_running == task) {
+        task->misses++;    // The first release keeps its timestamp
+        return;
+    }
+    task->released_at = TIM_tickless_now();
+}
+
+// released_at is snapshotted and sch_running set by SCH_dispatch, with the ready bit cleared
+static void SCH_stats_run(SCH_task_t *task, uint32_t released_at) {
+    uint32_t start   = TIM_tickless_now();
+    uint32_t latency = start - released_at;
+
+    task->function(task->ctx);
+    sch_running = NULL;
+
+    uint32_t exec = TIM_tickless_now() - start;
+    task->runs++;
+    task->exec_sum += exec;
+    if (exec < task->exec_min) task->exec_min = exec;
+    if (exec > task->exec_max) task->exec_max = exec;
+    if (latency < task->latency_min) task->latency_min = latency;
+    if (latency > task->latency_max) task->latency_max = latency;
+}
+#endif
+
+// Software timer expiration, interrupt context: only marks the task as ready
+static void SCH_timer_release(SWTIM_timer_t *timer, void *ctx) {
+#ifdef USE_SCH_STATS
+    SCH_stats_release((SCH_task_t *)ctx);
+#endif
+    sch_ready |= ((SCH_task_t *)ctx)->mask;
+}
+
+SCH_task_t *SCH_task_create(SCH_task_init_t *cfg) {
+    if (cfg->function == NULL || cfg->priority >= SCH_MAX_TASKS || sch_tasks[cfg->priority] != NULL) return NULL;
+
+    SCH_task_t *task = &sch_pool[cfg->priority];
+    task->function   = cfg->function;
+    task->ctx        = cfg->ctx;
+    task->mask       = (1 << cfg->priority);
+    task->timer      = NULL;
+#ifdef USE_SCH_STATS
+    SCH_stats_task_reset(task);
+#endif
+
+    if (cfg->mode != SCH_EVENT) {
+        SWTIM_init_t timer_cfg = {
+            .mode      = (cfg->mode == SCH_PERIODIC) ? SWTIM_PERIODIC : SWTIM_ONE_SHOT,
+            .period_us = (cfg->mode == SCH_PERIODIC) ? cfg->period_us : cfg->offset_us,
+            .delay_us  = cfg->offset_us,
+            .callback  = SCH_timer_release,
+            .ctx       = task,
+        };
+        task->timer = SWTIM_create(&timer_cfg);
+        if (task->timer == NULL) return NULL;
+    }
+
+    sch_tasks[cfg->priority] = task;
+    return task;
+}
+
+void SCH_task_delete(SCH_task_t *task) {
+    SCH_task_stop(task);
+    if (task->timer) SWTIM_delete(task->timer);
+    for (uint8_t i = 0; i < SCH_MAX_TASKS; i++) {
+        if (sch_tasks[i] == task) sch_tasks[i] = NULL;
+    }
+}
+
+void SCH_task_start(SCH_task_t *task) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        sch_ready &= ~task->mask;
+        if (task->timer) SWTIM_start(task->timer);
+    }
+}
+
+void SCH_task_stop(SCH_task_t *task) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (task->timer) SWTIM_stop(task->timer);
+        sch_ready &= ~task->mask;
+    }
+}
+
+void SCH_task_release(SCH_task_t *task) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#ifdef USE_SCH_STATS
+        SCH_stats_release(task);
+#endif
+        sch_ready |= task->mask;
+    }
+}
+
+bool SCH_dispatch(void) {
+    uint8_t ready = sch_ready;
+    if (ready == 0) return false;
+
+    uint8_t priority = 0;
+    while (!(ready & (1 << priority))) priority++;
+
+    SCH_task_t *task = sch_tasks[priority];
+#ifdef USE_SCH_STATS
+    uint32_t released_at = 0;
+#endif
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        sch_ready &= ~(1 << priority);    // Cleared before running: a release during the task is kept
+#ifdef USE_SCH_STATS
+        if (task) {    // Same step: a release in between would overwrite released_at without a miss
+            released_at = task->released_at;
+            sch_running = task;
+        }
+#endif
+    }
+    if (task == NULL) return true;
+#ifdef USE_SCH_STATS
+    SCH_stats_run(task, released_at);
+#else
+    task->function(task->ctx);
+#endif
+    return true;
+}
+
+void SCH_idle(void) {
+    cli();
+    if (sch_ready == 0) {    // Checked with interrupts off: a release cannot slip before the sleep
+#ifdef USE_SCH_STATS
+        uint32_t start = TIM_tickless_now();
+#endif
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+#ifdef USE_SCH_STATS
+        sch_idle_ticks += TIM_tickless_now() - start;    // Includes the ISR that woke the CPU
+#endif
+    }
+    sei();
+}
+
+void SCH_run(void) {
+    while (1) {
+        if (!SCH_dispatch()) SCH_idle();
+    }
+}
+
+#ifdef USE_SCH_STATS
+/* ----------------------------- Instrumentation ---------------------------- */
+void SCH_stats_reset(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < SCH_MAX_TASKS; i++) {
+            if (sch_tasks[i]) SCH_stats_task_reset(sch_tasks[i]);
+        }
+        sch_idle_ticks   = 0;
+        sch_window_start = TIM_tickless_now();
+    }
+}
+
+uint16_t SCH_stats_get_load_permille(void) {
+    uint32_t ticks_per_mille = (TIM_tickless_now() - sch_window_start) / 1000;    // No 32 bit overflow of idle * 1000
+    if (ticks_per_mille == 0) return 0;
+    uint32_t idle_permille = sch_idle_ticks / ticks_per_mille;
+    return (idle_permille < 1000) ? 1000 - idle_permille : 0;
+}
+
+static void SCH_stats_write(const void *data, uint8_t size, uint8_t *checksum) {
+    const uint8_t *bytes = data;
+    for (uint8_t i = 0; i < size; i++) {
+        *checksum += bytes[i];
+        putchar(bytes[i]);
+    }
+}
+
+void SCH_stats_dump(void) {
+    SCH_stats_header_t header = {
+        .sync          = SCH_STATS_SYNC,
+        .version       = SCH_STATS_VERSION,
+        .n_tasks       = 0,
+        .tick_us       = TIM_tickless_get_tick_us(),
+        .load_permille = SCH_stats_get_load_permille(),
+        .window_ticks  = TIM_tickless_now() - sch_window_start,
+    };
+    for (uint8_t i = 0; i < SCH_MAX_TASKS; i++) {
+        if (sch_tasks[i]) header.n_tasks++;
+    }
+
+    uint8_t checksum = 0;
+    SCH_stats_write(&header, sizeof(header), &checksum);
+
+    for (uint8_t i = 0; i < SCH_MAX_TASKS; i++) {
+        SCH_task_t *task = sch_tasks[i];
+        if (task == NULL) continue;
+
+        SCH_stats_record_t record;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            record.misses = task->misses;
+        }
+        record.priority          = i;
+        record.runs              = task->runs;
+        record.exec_min_ticks    = task->runs ? task->exec_min : 0;
+        record.exec_max_ticks    = task->exec_max;
+        record.exec_avg_ticks    = task->runs ? task->exec_sum / task->runs : 0;
+        record.latency_min_ticks = task->runs ? task->latency_min : 0;
+        record.latency_max_ticks = task->latency_max;
+        SCH_stats_write(&record, sizeof(record), &checksum);
+    }
+    putchar((uint8_t)-checksum);
+}
+/* -------------------------------------------------------------------------- */
+#endif
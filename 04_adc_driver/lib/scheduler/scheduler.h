@@ -0,0 +1,97 @@
+/**
+ * @file scheduler.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "../../board.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative run to completion scheduler. Releases come from software timers (SWTIM, O(1)
+// per tick) or from any ISR, and only set the ready bit of the task: the tasks themselves
+// run in the main loop, highest priority first, so interrupts are never held by task code.
+// The software timers must be initialized (SWTIM_init or SWTIM_init_tickless) and ticking.
+#ifndef SCH_MAX_TASKS
+#define SCH_MAX_TASKS 8    // One ready bit per priority level, up to 8
+#endif
+
+struct SCH_task;
+typedef struct SCH_task SCH_task_t;
+
+typedef void (*SCH_task_fn_t)(void *ctx);
+
+typedef enum {
+    SCH_PERIODIC,    // Released every period_us, the first time offset_us after start
+    SCH_ONE_SHOT,    // Released once, offset_us after start
+    SCH_EVENT,       // Released only by SCH_task_release (no timer)
+} SCH_mode_t;
+
+typedef struct {
+    SCH_task_fn_t function;
+    void *ctx;
+    SCH_mode_t mode;
+    uint8_t priority;      // 0 (highest) to SCH_MAX_TASKS - 1, one task per level
+    uint32_t period_us;    // SCH_PERIODIC
+    uint32_t offset_us;    // Phase of the first release, 0 = one period
+} SCH_task_init_t;
+
+SCH_task_t *SCH_task_create(SCH_task_init_t *cfg);
+void SCH_task_delete(SCH_task_t *task);
+
+void SCH_task_start(SCH_task_t *task);      // Restarts the phase, drops a pending release
+void SCH_task_stop(SCH_task_t *task);       // Drops a pending release
+void SCH_task_release(SCH_task_t *task);    // ISR safe: the task runs once in the main loop
+
+bool SCH_dispatch(void);    // Runs the highest priority ready task, false when none was ready
+void SCH_idle(void);        // Sleeps (mode set with set_sleep_mode) unless a task is ready
+void SCH_run(void);         // Dispatch/idle loop, never returns
+
+#ifdef USE_SCH_STATS
+/* Instrumentation ---------------------------- */
+// Sampled from the free running TIM_1 timestamp (TIM_tickless_init, TIM_tickless_get_tick_us
+// per tick). Per task: runs, execution time min/max/avg, release latency min/max (jitter is
+// max - min) and misses (released again before the previous release ran). The CPU load is the
+// time not spent sleeping in SCH_idle since the last reset.
+#define SCH_STATS_SYNC    0x5AA5U    // Little endian: 0xA5 0x5A on the wire
+#define SCH_STATS_VERSION 1U
+
+typedef struct __attribute__((packed)) {
+    uint16_t sync;
+    uint8_t version;
+    uint8_t n_tasks;          // Records that follow
+    uint16_t tick_us;
+    uint16_t load_permille;
+    uint32_t window_ticks;    // Time covered by the records
+} SCH_stats_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t priority;
+    uint32_t runs;
+    uint32_t misses;
+    uint32_t exec_min_ticks;
+    uint32_t exec_max_ticks;
+    uint32_t exec_avg_ticks;
+    uint32_t latency_min_ticks;    // Release to start
+    uint32_t latency_max_ticks;
+} SCH_stats_record_t;
+
+void SCH_stats_reset(void);
+uint16_t SCH_stats_get_load_permille(void);
+// Header, one record per created task and a checksum byte that makes the sum of all the bytes
+// zero, written raw to stdout (UART). Call it from a task so no record is cut by a dispatch.
+void SCH_stats_dump(void);
+#endif
+
+#endif    // SCHEDULER_H
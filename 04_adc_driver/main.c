@@ -1,111 +1,135 @@
 #include "Drivers/adc/adc.h"
 #include "Drivers/adc/adc_cal.h"
+#include "Drivers/adc/adc_filter.h"
 #include "Drivers/gpio/gpio.h"
+#include "Drivers/timer/soft_timer.h"
 #include "Drivers/timer/timer.h"
 #include "Drivers/uart/uart.h"
 #include "board.h"
+#include "lib/dfs/dfs.h"
+#include "lib/scheduler/scheduler.h"
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 
 /* -------------------------------- ADC Task -------------------------------- */
 ADC_handle_t *hadc0             = NULL;
 static ADC_channel_t current_ch = CH0;
 #define CH_VCC 3
-typedef struct {
-    float voltage;
-    uint8_t samples;
-} ADC_measurement_t;
-
-ADC_measurement_t measurements[4] = {0};
-
-static volatile bool is_vcc_measurment = false;    // NOTE: Is more scalable to use function pointers to update ones
-void ADC_EOC_callback(ADC_handle_t *hadc, uint16_t value_mV) {
-    if (is_vcc_measurment) {
-        GPIO_write_pin(GPIO_PORTB, GPIO_3, GPIO_LOW);
-        measurements[CH_VCC].voltage += value_mV / 1000.0f;
-        measurements[CH_VCC].samples++;
-    } else {
-        GPIO_write_pin(GPIO_PORTB, GPIO_5, GPIO_LOW);
-        measurements[current_ch].voltage += value_mV / 1000.0f;
-        measurements[current_ch].samples++;
-        current_ch = (current_ch + 1) % 3;
-    }
+
+static ADC_profile_t *channel_profiles[CH2 + 1] = {NULL};    // CH0..CH2 against AVCC, filtered
+static ADC_profile_t *vcc_profile               = NULL;
+
+static volatile uint16_t measurements_mV[4] = {0};    // Filtered value of each channel (ADC_filter)
+
+void adc_channel_eoc_callback(ADC_handle_t *hadc, uint16_t value_mV, void *ctx) {
+    GPIO_write_pin(GPIO_PORTB, GPIO_5, GPIO_LOW);
+    measurements_mV[current_ch] = value_mV;
+    current_ch                  = (current_ch + 1) % 3;
+}
+
+void adc_vcc_eoc_callback(ADC_handle_t *hadc, uint16_t value_mV, void *ctx) {
+    GPIO_write_pin(GPIO_PORTB, GPIO_3, GPIO_LOW);
+    *(volatile uint16_t *)ctx = value_mV;
 }
 
-void task_measure_adc_channel_update(void) {
-    is_vcc_measurment = false;
-    ADC_IT_read_mV(hadc0, current_ch);
+void task_measure_adc_channel_update(void *ctx) {
+    ADC_register_EOC_callback(hadc0, adc_channel_eoc_callback, NULL);
+    ADC_IT_read_profile_mV(hadc0, channel_profiles[current_ch]);
     GPIO_write_pin(GPIO_PORTB, GPIO_5, GPIO_HIGH);
     GPIO_toggle_pin(GPIO_PORTB, GPIO_0);
 }
 
-void task_measure_vcc_update(void) {
-    is_vcc_measurment = true;
-    ADC_IT_read_VCC_mV(hadc0);
+void task_measure_vcc_update(void *ctx) {
+    ADC_register_EOC_callback(hadc0, adc_vcc_eoc_callback, (void *)&measurements_mV[CH_VCC]);
+    ADC_IT_read_profile_mV(hadc0, vcc_profile);
     GPIO_write_pin(GPIO_PORTB, GPIO_3, GPIO_HIGH);
     GPIO_toggle_pin(GPIO_PORTB, GPIO_1);
 }
 /* -------------------------------------------------------------------------- */
 
 /* -------------------------------- UART Task ------------------------------- */
-#define N_SAMPLES 10
-void task_print_averages_update(void) {
-    for (uint8_t i = 0; i < sizeof(measurements) / sizeof(measurements[0]); i++) {
+void task_print_averages_update(void *ctx) {
+    for (uint8_t i = 0; i < sizeof(measurements_mV) / sizeof(measurements_mV[0]); i++) {
         if (i == CH_VCC) {
-            printf(">VCC:%.3f\n", measurements[i].voltage / measurements[i].samples);
-            // printf(">VCC:%.3f:%u\n", measurements[i].voltage / measurements[i].samples, measurements[i].samples);
+            printf(">VCC:%.3f\n", measurements_mV[i] / 1000.0f);
         } else {
-            printf(">ADC%d:%.3f\n", i, measurements[i].voltage / measurements[i].samples);
-            // printf(">ADC%d:%.3f:%u\n", i, measurements[i].voltage / measurements[i].samples, measurements[i].samples);
+            printf(">ADC%d:%.3f\n", i, measurements_mV[i] / 1000.0f);
         }
-        measurements[i].voltage = 0.0f;
-        measurements[i].samples = 0;
     }
 
     GPIO_toggle_pin(GPIO_PORTB, GPIO_2);
 }
 /* -------------------------------------------------------------------------- */
 
+#ifdef USE_SCH_STATS
+/* ------------------------------- Stats Task ------------------------------- */
+#define STATS_POLL_TIME_MS 100
+#define STATS_DUMP_COMMAND 'S'
+
+void task_stats_update(void *ctx) {    // Binary dump of the scheduler timing on request
+    if (!UART_is_available()) return;
+    if (getchar() != STATS_DUMP_COMMAND) return;
+    SCH_stats_dump();
+    SCH_stats_reset();
+}
+/* -------------------------------------------------------------------------- */
+#endif
+
 #define SAMPLE_TIME_MS_ADC      10
 #define START_TIME_VCC_MS       25
 #define SAMPLE_TIME_VCC_MS      30
 #define START_PRINT_AVG_TIME_MS 305
 #define PRINT_AVG_TIME_MS       300
 
-typedef struct {
-    void (*task_update)(void);
-    uint32_t start_time;
-    uint32_t last_time;
-    uint32_t update_time;
-} task_t;
-
+// Periodic tasks, priority 0 is left for the calibration
 #define N_TASKS 3
-task_t tasks[N_TASKS] = {
-    {.task_update = task_measure_adc_channel_update, .start_time = SAMPLE_TIME_MS_ADC, .last_time = 0, .update_time = SAMPLE_TIME_MS_ADC},
-    {.task_update = task_measure_vcc_update, .start_time = START_TIME_VCC_MS, .last_time = 0, .update_time = SAMPLE_TIME_VCC_MS},
-    {.task_update = task_print_averages_update, .start_time = START_PRINT_AVG_TIME_MS, .last_time = 0, .update_time = PRINT_AVG_TIME_MS},
+static SCH_task_init_t tasks_cfg[N_TASKS] = {
+    {.function = task_measure_adc_channel_update, .mode = SCH_PERIODIC, .priority = 1, .period_us = SAMPLE_TIME_MS_ADC * 1000UL},
+    {.function = task_measure_vcc_update, .mode = SCH_PERIODIC, .priority = 2, .period_us = SAMPLE_TIME_VCC_MS * 1000UL, .offset_us = START_TIME_VCC_MS * 1000UL},
+    {.function = task_print_averages_update, .mode = SCH_PERIODIC, .priority = 3, .period_us = PRINT_AVG_TIME_MS * 1000UL, .offset_us = START_PRINT_AVG_TIME_MS * 1000UL},
 };
+static SCH_task_t *tasks[N_TASKS] = {NULL};
 
-static volatile uint32_t tick = 0;
-void TIM_CTC_callback(TIM_handle_t *htim) {
-    tick++;
+void tickless_deadline_callback(TIM_handle_t *htim, void *ctx) {    // Only when a task is due (tickless), sets ready bits
     GPIO_toggle_pin(GPIO_PORTB, GPIO_4);
-    for (uint8_t i = 0; i < N_TASKS; i++) {
-        if ((tick == tasks[i].start_time) || (tick > tasks[i].start_time && (tick - tasks[i].last_time >= tasks[i].update_time))) {
-            tasks[i].last_time = tick;
-            tasks[i].task_update();
-        }
-    }
+    SWTIM_tick();
+}
+
+static ADC_CAL_auto_init_t adc_cal_cfg = {
+    .channel      = CH3,    // External 2.5 V reference (e.g. TL431) on ADC3
+    .reference_mV = 2500,
+    .n_samples    = 64,
+};
+
+static SCH_task_t *calibration_task = NULL;
+void calibration_request_callback(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state, void *ctx) {
+    SCH_task_release(calibration_task);    // Runs in the main loop, not in the ISR
 }
 
-void GPIO_EXTI_callback(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state) {
-    ADC_calibrate(hadc0);
-    tick = 0;
-    for (uint8_t i = 0; i < sizeof(measurements) / sizeof(measurements[0]); i++) {
-        measurements[i].voltage = 0.0f;
-        measurements[i].samples = 0;
+void calibration_update(void *ctx) {
+    for (uint8_t i = 0; i < N_TASKS; i++) {
+        SCH_task_stop(tasks[i]);
+    }
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    DFS_request();    // Burst at full speed
+#endif
+    if (!ADC_calibrate_auto(hadc0, &adc_cal_cfg)) {
+        printf("ERR_ADC_CALIBRATE\n");
+    }
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    DFS_release();
+#endif
+    for (uint8_t i = 0; i < sizeof(measurements_mV) / sizeof(measurements_mV[0]); i++) {
+        measurements_mV[i] = 0;
+    }
+    for (ADC_channel_t ch = CH0; ch <= CH2; ch++) {
+        ADC_filter_reset(ch);
     }
     current_ch = CH0;
+    for (uint8_t i = 0; i < N_TASKS; i++) {
+        SCH_task_start(tasks[i]);    // Start times count again from now
+    }
 }
 
 int main(void) {
@@ -120,6 +144,7 @@ int main(void) {
     GPIO_config(GPIO_PORTB, GPIO_4, GPIO_OUTPUT_INITIAL_LOW);     // GPIO_tick
     GPIO_config(GPIO_PORTB, GPIO_5, GPIO_OUTPUT_INITIAL_LOW);     // GPIO_sample
     GPIO_config(GPIO_PORTD, GPIO_2, GPIO_INPUT_IT_FALLING);       // Forced calibration (D2)
+    GPIO_EXTI_register_callback(GPIO_PORTD, GPIO_2, calibration_request_callback, NULL);
 
     ADC_init_t adc_config = {
         .bits               = ADC_10B_RESOLUTION,
@@ -136,36 +161,92 @@ int main(void) {
     }
     printf("ADC_INIT_OK\n");
 
-    if (!ADC_is_calibrated()) {
-        ADC_calibrate(hadc0);
-        printf("ADC_CALIBRATE_OK\n");
-    } else {
-        ADC_set_calibration(hadc0, ADC_get_calibration());
+    if (!ADC_is_calibrated()) {    // A stored calibration is already applied by ADC_init
+        if (ADC_calibrate_auto(hadc0, &adc_cal_cfg)) {
+            printf("ADC_CALIBRATE_OK\n");
+        } else {
+            printf("ERR_ADC_CALIBRATE\n");
+        }
     }
 
-    TIM_init_t tim0_cfg = {
-        .timer        = TIM_0,
-        .clk_source   = TIM_CLK_INTERNAL_PRESCALER_DIV64,
-        .mode         = CTC_CHANNEL_A_NO_OUTPUT,
-        .preset_value = 250,    // 1ms
-    };
+    // Same reference for every profile: switching between them never waits for AREF to settle
+    static uint16_t filter_windows[CH2 + 1][4];
+    for (ADC_channel_t ch = CH0; ch <= CH2; ch++) {
+        ADC_profile_init_t profile_cfg = {
+            .channel   = ch,
+            .reference = ADC_AVCC,
+            .bits      = ADC_10B_RESOLUTION,
+            .filter    = {.type = ADC_FILTER_MOVING_AVERAGE, .window = filter_windows[ch], .window_size = 4},
+        };
+        channel_profiles[ch] = ADC_profile_init(hadc0, &profile_cfg);
+    }
+    ADC_profile_init_t vcc_cfg = {.channel = CH_VBG, .reference = ADC_AVCC, .bits = ADC_10B_RESOLUTION, .settle_us = 70};    // Bandgap start-up
+    vcc_profile                = ADC_profile_init(hadc0, &vcc_cfg);
+    if (!channel_profiles[CH0] || !channel_profiles[CH1] || !channel_profiles[CH2] || !vcc_profile) {
+        printf("ERR_ADC_PROFILE\n");
+        return 1;
+    }
+
+#ifdef USE_TIMER_BENCHMARK
+    TIM_benchmark_t bench;
+    if (TIM_benchmark_reload(&bench)) {
+        printf("TIM_base_start: %u cycles\n", bench.base_start_cycles);
+    }
+#endif
+
+    TIM_handle_t *htim1 = TIM_tickless_init();
+    if (!htim1) {
+        printf("Error initializing TIM1 tickless\n");
+        return 1;
+    }
+    TIM_register_callback(htim1, TIM_EVENT_DEADLINE, tickless_deadline_callback, NULL);
+    printf("TIM1_INIT_OK\n");
 
-    TIM_handle_t *htim0 = TIM_CTC_init(&tim0_cfg);
-    if (!htim0) {
-        printf("Error initializing TIM0 CTC A\n");
+    SWTIM_init_tickless();
+    for (uint8_t i = 0; i < N_TASKS; i++) {
+        tasks[i] = SCH_task_create(&tasks_cfg[i]);
+        if (!tasks[i]) {
+            printf("ERR_SCH_CREATE\n");
+            return 1;
+        }
+    }
+    SCH_task_init_t calibration_cfg = {.function = calibration_update, .mode = SCH_EVENT, .priority = 0};
+    calibration_task                = SCH_task_create(&calibration_cfg);
+    if (!calibration_task) {
+        printf("ERR_SCH_CREATE\n");
+        return 1;
+    }
+#ifdef USE_SCH_STATS
+    SCH_task_init_t stats_cfg = {.function = task_stats_update, .mode = SCH_PERIODIC, .priority = SCH_MAX_TASKS - 1, .period_us = STATS_POLL_TIME_MS * 1000UL};
+    SCH_task_t *stats_task    = SCH_task_create(&stats_cfg);
+    if (!stats_task) {
+        printf("ERR_SCH_CREATE\n");
         return 1;
     }
-    printf("TIM0_INIT_OK\n");
+    SCH_task_start(stats_task);
+    SCH_stats_reset();
+#endif
+
+#ifdef USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
+    // Slow between the calibration bursts: UART, ADC and TIM_1 keep their timings at F_CLK / 8
+    DFS_init_t dfs_cfg = {.fast = CLK_DIV_1, .slow = CLK_DIV_8, .up_permille = 700, .down_permille = 300};
+    if (!DFS_init(&dfs_cfg)) {
+        printf("ERR_DFS_INIT\n");
+        return 1;
+    }
+#endif
 
     GPIO_toggle_pin(GPIO_PORTB, GPIO_4);
     GPIO_toggle_pin(GPIO_PORTB, GPIO_4);
 
     sei();
 
-    TIM_CTC_A_start_IT(htim0);
-
-    while (1) {
+    for (uint8_t i = 0; i < N_TASKS; i++) {
+        SCH_task_start(tasks[i]);
     }
 
+    set_sleep_mode(SLEEP_MODE_IDLE);    // TIM1 and the ADC keep running
+    SCH_run();                          // Sleeps until the next deadline (or any other interrupt)
+
     return 0;
 }
@@ -2,6 +2,8 @@
 #ifdef USE_ADC
 
 #include "adc_cal.h"
+#include "../../lib/event/event.h"
+#include "../power/power.h"
 #include <avr/interrupt.h>
 #include <stddef.h>
 #include <util/delay.h>
@@ -38,6 +40,7 @@ typedef enum {
 } ADC_IT_last_call_t;
 
 static ADC_IT_last_call_t ADC_IT_last_state = ADC_IT_IDLE;
+static volatile bool adc_is_sleep_limited    = false;    // IT conversion running, the ADC stops below ADC noise reduction
 
 static ADC_handle_t adc_handle = {
     .is_avaliable     = true,
@@ -120,6 +123,7 @@ static inline __attribute__((always_inline)) void ADC_set_channel(ADC_channel_t
 static ADC_handle_t *ADC_register_handle(void) {
     if (adc_handle.is_avaliable) {
         adc_handle.is_avaliable = false;
+        PWR_acquire(PWR_ADC);
         return &adc_handle;
     }
     return NULL;
@@ -128,6 +132,7 @@ static ADC_handle_t *ADC_register_handle(void) {
 static void ADC_unregister_handle(ADC_handle_t *hadc) {
     if (!adc_handle.is_avaliable) {
         adc_handle.is_avaliable = true;
+        PWR_release(PWR_ADC);    // ADEN already cleared: the ADC must be off before its clock stops
     }
 }
 
@@ -230,6 +235,10 @@ void ADC_IT_read_base(ADC_handle_t *hadc, ADC_channel_t channel, uint16_t delay_
     if (hadc->state == ADC_BUSY) return;
 
     hadc->state = ADC_BUSY;
+    if (!adc_is_sleep_limited) {
+        adc_is_sleep_limited = true;
+        EVT_sleep_limit(EVT_SLEEP_ADC_NOISE_REDUCTION);
+    }
     ADC_set_channel(channel);
     ADC_delay(delay_us);
 
@@ -291,6 +300,10 @@ ISR(ADC_vect) {
         adc_handle.state  = ADC_IDLE;
         ADC_IT_last_state = ADC_IT_IDLE;
     }
+    if (adc_is_sleep_limited) {
+        adc_is_sleep_limited = false;
+        EVT_sleep_unlimit(EVT_SLEEP_ADC_NOISE_REDUCTION);
+    }
 }
 
 #endif
\ No newline at end of file
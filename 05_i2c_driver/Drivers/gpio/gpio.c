@@ -105,10 +105,19 @@ static inline __attribute__((always_inline)) void GPIO_PCICR_config(GPIO_port_t
     }
 }
 
+// PC0-PC5 (ADC low power channels) and PD6/PD7 (AIN0/AIN1, off since startup with USE_POWER)
+// may have their digital input buffer disabled, which reads the pin always as low
+static void GPIO_digital_input_enable(GPIO_port_t port, GPIO_pin_t pins) {
+    if (port == GPIO_PORTC) DIDR0 &= ~(pins & (1 << ADC5D | 1 << ADC4D | 1 << ADC3D | 1 << ADC2D | 1 << ADC1D | 1 << ADC0D));
+    if (port == GPIO_PORTD) DIDR1 &= ~((pins >> 6) & (1 << AIN1D | 1 << AIN0D));
+}
+
 void GPIO_config(GPIO_port_t port, GPIO_pin_t pins, GPIO_mode_t mode) {
     ASSERT_GPIO_PORT(port, );
     GPIO_regs_t reg = GPIO_get_registers(port);
 
+    if (mode >= GPIO_INPUT) GPIO_digital_input_enable(port, pins);    // Every mode from GPIO_INPUT on is an input
+
     switch (mode) {
     case GPIO_INPUT:
         *reg.ddrx &= ~pins;
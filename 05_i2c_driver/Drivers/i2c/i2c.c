@@ -13,68 +13,157 @@
  */
 #include "i2c.h"
 #include "../../board.h"
+#include "../../lib/event/event.h"
+#include "../power/power.h"
 #include <avr/io.h>
 #include <util/twi.h>
 
+static bool i2c_is_initialized = false;    // Several devices may init the same bus
+static bool i2c_is_busy        = false;    // Holds EVT_SLEEP_IDLE: the master runs on the I/O clock
+
+static inline __attribute__((always_inline)) void I2C_busy_begin(void) {
+    if (i2c_is_busy) return;
+    i2c_is_busy = true;
+    EVT_sleep_limit(EVT_SLEEP_IDLE);
+}
+
+static inline __attribute__((always_inline)) void I2C_busy_end(void) {
+    if (!i2c_is_busy) return;
+    i2c_is_busy = false;
+    EVT_sleep_unlimit(EVT_SLEEP_IDLE);
+}
+
 void I2C_init(I2C_freq_t freq) {
+    if (!i2c_is_initialized) {
+        PWR_acquire(PWR_TWI);
+        i2c_is_initialized = true;
+    }
     TWSR = 0x00;    // Prescaler = 1
     TWBR = ((F_CPU / freq) - 16) / 2;
     TWCR = (1 << TWEN);
 }
 
+void I2C_deinit(void) {
+    if (!i2c_is_initialized) return;
+    TWCR = 0x00;    // Releases SCL/SDA before the clock stops
+    I2C_busy_end();
+    PWR_release(PWR_TWI);
+    i2c_is_initialized = false;
+}
+
 void I2C_reset(void) {
     TWCR &= ~(1 << TWEN);
     TWCR |= (1 << TWEN);
+    I2C_busy_end();
 }
 
 #define TIMEOUT 10000
 
+#define I2C_STATUS_MSK     0xF8
+#define I2C_EXPECTED_STOP  0x00    // Not a TWSR status: the STOP is done when TWSTO clears
+#define I2C_EXPECTED_START TW_START
+
+static uint8_t i2c_expected   = I2C_EXPECTED_STOP;    // Status of the issued operation
+static I2C_status_t i2c_error = I2C_OK;               // Returned when another status is read
+
+/* ------------------------------ Non blocking ------------------------------ */
+void I2C_issue_start(void) {
+    i2c_expected = I2C_EXPECTED_START;
+    i2c_error    = I2C_ERR_START;
+    I2C_busy_begin();
+    TWCR         = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+}
+
+void I2C_issue_address(uint8_t addr, bool read) {
+    i2c_expected = read ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+    i2c_error    = I2C_ERR_SLA_NACK;
+    I2C_busy_begin();
+    TWDR         = (addr << 1) | (read ? 0x01 : 0x00);
+    TWCR         = (1 << TWINT) | (1 << TWEN);
+}
+
+void I2C_issue_write(uint8_t data) {
+    i2c_expected = TW_MT_DATA_ACK;
+    i2c_error    = I2C_ERR_DATA_NACK;
+    I2C_busy_begin();
+    TWDR         = data;
+    TWCR         = (1 << TWINT) | (1 << TWEN);
+}
+
+void I2C_issue_read(bool ack) {
+    i2c_expected = ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+    i2c_error    = I2C_ERR_DATA_NACK;
+    I2C_busy_begin();
+    TWCR         = (1 << TWINT) | (1 << TWEN) | (ack ? (1 << TWEA) : 0);
+}
+
+void I2C_issue_stop(void) {
+    i2c_expected = I2C_EXPECTED_STOP;
+    i2c_error    = I2C_OK;
+    I2C_busy_begin();
+    TWCR         = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+}
+
+bool I2C_is_done(void) {
+    bool is_done = (i2c_expected == I2C_EXPECTED_STOP) ? !(TWCR & (1 << TWSTO)) : (TWCR & (1 << TWINT));
+    if (is_done) I2C_busy_end();
+    return is_done;
+}
+
+I2C_status_t I2C_get_result(void) {
+    uint8_t status = TWSR & I2C_STATUS_MSK;
+    if (status == i2c_expected) return I2C_OK;
+    if (i2c_expected == I2C_EXPECTED_START && status == TW_REP_START) return I2C_OK;
+    return i2c_error;
+}
+
+uint8_t I2C_get_data(void) {
+    return TWDR;
+}
+
+/* -------------------------------- Blocking -------------------------------- */
 static inline __attribute__((always_inline)) uint8_t wait_for_twint(void) {
     uint16_t count = 0;
     while (!(TWCR & (1 << TWINT))) {
-        if (++count > TIMEOUT) return 0;
+        if (++count > TIMEOUT) {
+            I2C_busy_end();
+            return 0;
+        }
     }
+    I2C_busy_end();
     return 1;
 }
 
-I2C_status_t I2C_start(uint8_t addr) {
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+static I2C_status_t I2C_blocking(void) {
     if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
+    return I2C_get_result();
+}
 
-    if ((TWSR & 0xF8) != TW_START)
-        return I2C_ERR_START;
-
-    TWDR = (addr << 1);    // modo escritura
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
+I2C_status_t I2C_start(uint8_t addr) {
+    I2C_issue_start();
+    I2C_status_t status = I2C_blocking();
+    if (status != I2C_OK) return status;
 
-    return ((TWSR & 0xF8) == TW_MT_SLA_ACK) ? I2C_OK : I2C_ERR_SLA_NACK;
+    I2C_issue_address(addr, false);    // modo escritura
+    return I2C_blocking();
 }
 
 I2C_status_t I2C_start_read(uint8_t addr) {
-    TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-    if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
-
-    if ((TWSR & 0xF8) != TW_START)
-        return I2C_ERR_START;
+    I2C_issue_start();
+    I2C_status_t status = I2C_blocking();
+    if (status != I2C_OK) return status;
 
-    TWDR = (addr << 1) | 0x01;    // modo lectura
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
-
-    return ((TWSR & 0xF8) == TW_MR_SLA_ACK) ? I2C_OK : I2C_ERR_SLA_NACK;
+    I2C_issue_address(addr, true);    // modo lectura
+    return I2C_blocking();
 }
 
 I2C_status_t I2C_write(uint8_t data) {
-    TWDR = data;
-    TWCR = (1 << TWINT) | (1 << TWEN);
-    if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
-
-    return ((TWSR & 0xF8) == TW_MT_DATA_ACK) ? I2C_OK : I2C_ERR_DATA_NACK;
+    I2C_issue_write(data);
+    return I2C_blocking();
 }
 
 I2C_status_t I2C_read_ack(uint8_t *data) {
-    TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
+    I2C_issue_read(true);
     if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
 
     *data = TWDR;
@@ -82,7 +171,7 @@ I2C_status_t I2C_read_ack(uint8_t *data) {
 }
 
 I2C_status_t I2C_read_nack(uint8_t *data) {
-    TWCR = (1 << TWINT) | (1 << TWEN);
+    I2C_issue_read(false);
     if (!wait_for_twint()) return I2C_ERR_TIMEOUT;
 
     *data = TWDR;
@@ -90,7 +179,8 @@ I2C_status_t I2C_read_nack(uint8_t *data) {
 }
 
 void I2C_stop(void) {
-    TWCR             = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+    I2C_issue_stop();
     uint16_t timeout = 1000;
-    while ((TWCR & (1 << TWSTO)) && --timeout);
+    while (!I2C_is_done() && --timeout);
+    I2C_busy_end();    // Timed out
 }
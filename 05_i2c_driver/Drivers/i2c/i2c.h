@@ -17,6 +17,7 @@
 #include "../../board.h"
 #ifdef USE_I2C
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
@@ -41,6 +42,11 @@ typedef enum {
  */
 void I2C_init(I2C_freq_t freq);
 
+/**
+ * @brief Apaga el periférico TWI y detiene su reloj (PRR)
+ */
+void I2C_deinit(void);
+
 /**
  * @brief Envía condición de START y dirección del esclavo en modo escritura
  *
@@ -89,5 +95,19 @@ void I2C_stop(void);
  */
 void I2C_reset(void);
 
+/* Non blocking ------------------------------- */
+// Each I2C_issue_x only starts one bus operation and returns. I2C_is_done() turns true when
+// the TWI finished it (TWINT, or TWSTO cleared for the STOP) and I2C_get_result() checks the
+// bus status expected for that operation. Meant to be awaited from protothreads (lib/pt).
+void I2C_issue_start(void);    // START, or repeated START inside a transfer
+void I2C_issue_address(uint8_t addr, bool read);
+void I2C_issue_write(uint8_t data);
+void I2C_issue_read(bool ack);    // ack = false for the last byte
+void I2C_issue_stop(void);
+
+bool I2C_is_done(void);
+I2C_status_t I2C_get_result(void);
+uint8_t I2C_get_data(void);    // Byte of the last read, once done
+
 #endif
 #endif    // I2C_H
\ No newline at end of file
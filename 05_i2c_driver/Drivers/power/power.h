@@ -0,0 +1,53 @@
+/**
+ * @file power.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief Power reduction driver
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "../../board.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// PRR bit of each peripheral
+typedef enum {
+    PWR_ADC    = 0,
+    PWR_USART0 = 1,
+    PWR_SPI    = 2,
+    PWR_TIM1   = 3,
+    PWR_TIM0   = 5,
+    PWR_TIM2   = 6,
+    PWR_TWI    = 7,
+} PWR_peripheral_t;
+
+#ifdef USE_POWER
+
+// Before main() every peripheral clock is stopped, together with the analog comparator and the
+// digital input buffers of its AIN0/AIN1 pins (GPIO_config turns them back on for inputs).
+// Each driver acquires its peripheral at init and releases it at deinit: the clock only runs
+// while there is at least one user. A released peripheral keeps its registers, but they can
+// not be written until it is acquired again.
+void PWR_acquire(PWR_peripheral_t peripheral);
+void PWR_release(PWR_peripheral_t peripheral);
+bool PWR_is_active(PWR_peripheral_t peripheral);
+
+#else
+
+#define PWR_acquire(peripheral)   ((void)(peripheral))
+#define PWR_release(peripheral)   ((void)(peripheral))
+#define PWR_is_active(peripheral) ((void)(peripheral), true)
+
+#endif
+
+#endif    // POWER_H
@@ -17,6 +17,7 @@
  */
 
 #include "timer.h"
+#include "../power/power.h"
 #ifdef USE_TIMER
 
 #include <avr/interrupt.h>
@@ -145,8 +146,11 @@ static uint8_t TIM_get_clk_source_bits(TIM_handle_t *htim) {
     }
 }
 
+static const PWR_peripheral_t tim_power[3] = {[TIM_0] = PWR_TIM0, [TIM_1] = PWR_TIM1, [TIM_2] = PWR_TIM2};
+
 static TIM_handle_t *TIM_register_handle(TIM_timer_t timer) {
     if (!timer_handles[timer].is_available) return NULL;
+    PWR_acquire(tim_power[timer]);    // Before the registers are written by the init
     timer_handles[timer].is_available = false;
     return &timer_handles[timer];
 }
@@ -1,8 +1,11 @@
 #include "../../../02_driver_timer/Drivers/uart/uart.h"
 #include "../../board.h"
+#include "../../lib/event/event.h"
+#include "../power/power.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 #include <util/setbaud.h>
 
 static int UART_write_byte(char write_byte, FILE *stream);
@@ -11,7 +14,14 @@ static int UART_read_byte(FILE *stream);
 static FILE UART_stdin  = FDEV_SETUP_STREAM(NULL, UART_read_byte, _FDEV_SETUP_READ);
 static FILE UART_stdout = FDEV_SETUP_STREAM(UART_write_byte, NULL, _FDEV_SETUP_WRITE);
 
+static volatile bool uart_is_sending = false;    // Holds EVT_SLEEP_IDLE until the last stop bit is out
+
 void UART_init(void) {
+    static bool is_acquired = false;    // UART_init may be called again, the USART has a single user
+    if (!is_acquired) {
+        PWR_acquire(PWR_USART0);
+        is_acquired = true;
+    }
     UBRR0H = UBRRH_VALUE;    // Mirar setbaud.h
     UBRR0L = UBRRL_VALUE;
 #if USE_2X
@@ -38,7 +48,15 @@ bool UART_is_available(void) {
 
 static int UART_write_byte(char write_byte, FILE *stream) {
     loop_until_bit_is_set(UCSR0A, UDRE0);    // Wait for empty transmit buffer
-    UDR0 = write_byte;                       // write one byte to UART0
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!uart_is_sending) {
+            uart_is_sending = true;
+            EVT_sleep_limit(EVT_SLEEP_IDLE);
+            UCSR0A = (UCSR0A & (1 << U2X0 | 1 << MPCM0)) | (1 << TXC0);    // Stale flag of the last frame, FE0/DOR0/UPE0 written 0
+            UCSR0B |= (1 << TXCIE0);
+        }
+        UDR0 = write_byte;    // write one byte to UART0
+    }
     return 0;
 }
 
@@ -47,7 +65,11 @@ static int UART_read_byte(FILE *stream) {
     return UDR0;                            // read one byte from UART0
 }
 
+// Shift register and UDR0 empty: the USART no longer needs the I/O clock
 ISR(USART_TX_vect) {
+    UCSR0B &= ~(1 << TXCIE0);
+    uart_is_sending = false;
+    EVT_sleep_unlimit(EVT_SLEEP_IDLE);
 }
 
 ISR(USART_RX_vect) {
@@ -71,6 +71,9 @@ static float f_cpu_hz = F_CPU_HZ;
 // CPU Prescaler -----------------------------
 // #define USE_CPU_CLOCK_PRESCALER_AT_RUNTIME
 
+// Power -------------------------------------
+#define USE_POWER    // Peripheral clocks (PRR) only run while a driver uses them
+
 // GPIO --------------------------------------
 #define USE_GPIO
 
@@ -82,7 +85,7 @@ static float f_cpu_hz = F_CPU_HZ;
 #define USE_UART
 
 // TIM ---------------------------------------
-// #define USE_TIMER
+#define USE_TIMER
 
 // I2C ---------------------------------------
 #define USE_I2C
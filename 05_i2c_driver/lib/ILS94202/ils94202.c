@@ -27,6 +27,8 @@ struct ILS94202_handle {
     I2C_freq_t i2c_freq;
     uint8_t address;
     bool is_pullup_external;
+    PT_timer_t timeout;    // Non blocking transfers
+    I2C_status_t status;
 };
 
 static ILS94202_handle_t ILS94202_handle = {0};
@@ -96,3 +98,81 @@ bool ILS94202_is_not_power_down(ILS94202_handle_t *hILS94202) {
     // // I2C_start(hILS94202->i2c_freq);
     // return sda_level == GPIO_HIGH && scl_level == GPIO_HIGH;
 }
+
+/* ------------------------------ Non blocking ------------------------------ */
+// Awaits the bus operation just issued. A bus error or a timeout jumps to the STOP of the transfer
+#define ILS94202_AWAIT(pt, h)                                                \
+    do {                                                                     \
+        PT_timer_set(&(h)->timeout, ILS94202_TWI_TIMEOUT_MS);                \
+        PT_WAIT_UNTIL(pt, I2C_is_done() || PT_timer_expired(&(h)->timeout)); \
+        (h)->status = I2C_is_done() ? I2C_get_result() : I2C_ERR_TIMEOUT;    \
+        if ((h)->status != I2C_OK) goto stop;                                \
+    } while (0)
+
+#define ILS94202_STOP(pt, h)                                                 \
+    do {                                                                     \
+        I2C_issue_stop();                                                    \
+        PT_timer_set(&(h)->timeout, ILS94202_TWI_TIMEOUT_MS);                \
+        PT_WAIT_UNTIL(pt, I2C_is_done() || PT_timer_expired(&(h)->timeout)); \
+    } while (0)
+
+PT_THREAD(ILS94202_read_register_pt(PT_t *pt, ILS94202_handle_t *hILS94202, uint8_t reg, uint8_t *value)) {
+    PT_BEGIN(pt);
+
+    I2C_issue_start();
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_address(hILS94202->address, false);
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_write(reg);
+    ILS94202_AWAIT(pt, hILS94202);
+
+    I2C_issue_start();    // Repeated START
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_address(hILS94202->address, true);
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_read(false);
+    ILS94202_AWAIT(pt, hILS94202);
+    *value = I2C_get_data();
+
+stop:
+    ILS94202_STOP(pt, hILS94202);
+    PT_END(pt);
+}
+
+PT_THREAD(ILS94202_write_register_pt(PT_t *pt, ILS94202_handle_t *hILS94202, uint8_t reg, uint8_t value)) {
+    PT_BEGIN(pt);
+
+    I2C_issue_start();
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_address(hILS94202->address, false);
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_write(reg);
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_write(value);
+    ILS94202_AWAIT(pt, hILS94202);
+
+stop:
+    ILS94202_STOP(pt, hILS94202);
+    PT_END(pt);
+}
+
+PT_THREAD(ILS94202_set_power_down_mode_pt(PT_t *pt, ILS94202_handle_t *hILS94202)) {
+    return ILS94202_write_register_pt(pt, hILS94202, CTRL3_REG_ADDRESS, CTRL3_REG_PWDN_BIT);
+}
+
+PT_THREAD(ILS94202_probe_pt(PT_t *pt, ILS94202_handle_t *hILS94202)) {
+    PT_BEGIN(pt);
+
+    I2C_issue_start();
+    ILS94202_AWAIT(pt, hILS94202);
+    I2C_issue_address(hILS94202->address, false);
+    ILS94202_AWAIT(pt, hILS94202);
+
+stop:
+    ILS94202_STOP(pt, hILS94202);
+    PT_END(pt);
+}
+
+I2C_status_t ILS94202_get_status(ILS94202_handle_t *hILS94202) {
+    return hILS94202->status;
+}
@@ -16,6 +16,7 @@
 
 #include "../../Drivers/gpio/gpio.h"
 #include "../../Drivers/i2c/i2c.h"
+#include "../pt/pt.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -39,4 +40,16 @@ void ILS94202_set_slave_address(ILS94202_handle_t *hILS94202, uint8_t slave_addr
 I2C_status_t ILS94202_set_power_down_mode(ILS94202_handle_t *hILS94202);
 bool ILS94202_is_not_power_down(ILS94202_handle_t *hILS94202);
 
+/* Non blocking ------------------------------- */
+// The same transfers as protothreads (lib/pt): call them until PT_SCHEDULE() is false and then
+// read the outcome with ILS94202_get_status(). Every bus operation is awaited with a timeout
+// on PT_clock_ms, given by the application. One transfer at a time per handle.
+#define ILS94202_TWI_TIMEOUT_MS 2U
+
+PT_THREAD(ILS94202_read_register_pt(PT_t *pt, ILS94202_handle_t *hILS94202, uint8_t reg, uint8_t *value));
+PT_THREAD(ILS94202_write_register_pt(PT_t *pt, ILS94202_handle_t *hILS94202, uint8_t reg, uint8_t value));
+PT_THREAD(ILS94202_set_power_down_mode_pt(PT_t *pt, ILS94202_handle_t *hILS94202));
+PT_THREAD(ILS94202_probe_pt(PT_t *pt, ILS94202_handle_t *hILS94202));    // I2C_OK: not in power down
+I2C_status_t ILS94202_get_status(ILS94202_handle_t *hILS94202);
+
 #endif    // ILS94202_H
\ No newline at end of file
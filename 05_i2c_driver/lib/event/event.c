@@ -0,0 +1,133 @@
+/**
+ * @file event.c
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-16
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#include "event.h"
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stddef.h>
+#include <util/atomic.h>
+
+#if EVT_MAX_EVENTS > 8
+#error "EVT_MAX_EVENTS must fit the 8 bit pending mask"
+#endif
+
+typedef struct {
+    EVT_handler_t handler;
+    void *ctx;
+    EVT_sleep_t deepest_sleep;
+} EVT_entry_t;
+
+static EVT_entry_t evt_entries[EVT_MAX_EVENTS] = {{NULL}};    // Indexed by event
+static volatile uint8_t evt_pending            = 0;
+static uint8_t evt_limits[EVT_N_SLEEP]         = {0};    // Handlers and limits holding each mode
+
+static const uint8_t evt_sleep_modes[EVT_N_SLEEP] = {
+    [EVT_SLEEP_IDLE]                = SLEEP_MODE_IDLE,
+    [EVT_SLEEP_ADC_NOISE_REDUCTION] = SLEEP_MODE_ADC,
+    [EVT_SLEEP_POWER_SAVE]          = SLEEP_MODE_PWR_SAVE,
+    [EVT_SLEEP_POWER_DOWN]          = SLEEP_MODE_PWR_DOWN,
+};
+
+bool EVT_register(EVT_init_t *cfg) {
+    if (cfg->handler == NULL || cfg->event >= EVT_MAX_EVENTS || cfg->deepest_sleep >= EVT_N_SLEEP) return false;
+    if (evt_entries[cfg->event].handler != NULL) return false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        evt_entries[cfg->event].handler       = cfg->handler;
+        evt_entries[cfg->event].ctx           = cfg->ctx;
+        evt_entries[cfg->event].deepest_sleep = cfg->deepest_sleep;
+        evt_limits[cfg->deepest_sleep]++;
+        evt_pending &= ~(1 << cfg->event);
+    }
+    return true;
+}
+
+void EVT_unregister(uint8_t event) {
+    if (event >= EVT_MAX_EVENTS || evt_entries[event].handler == NULL) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        evt_limits[evt_entries[event].deepest_sleep]--;
+        evt_entries[event].handler = NULL;
+        evt_pending &= ~(1 << event);
+    }
+}
+
+void EVT_post(uint8_t event) {
+    if (event >= EVT_MAX_EVENTS) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        evt_pending |= (1 << event);
+    }
+}
+
+void EVT_sleep_limit(EVT_sleep_t deepest_sleep) {
+    if (deepest_sleep >= EVT_N_SLEEP) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        evt_limits[deepest_sleep]++;
+    }
+}
+
+void EVT_sleep_unlimit(EVT_sleep_t deepest_sleep) {
+    if (deepest_sleep >= EVT_N_SLEEP) return;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (evt_limits[deepest_sleep]) evt_limits[deepest_sleep]--;
+    }
+}
+
+EVT_sleep_t EVT_get_sleep(void) {
+    EVT_sleep_t sleep = EVT_SLEEP_IDLE;
+    while (sleep < EVT_SLEEP_POWER_DOWN && evt_limits[sleep] == 0) sleep++;
+    return sleep;
+}
+
+// An event is consumed when its handler starts: posting it again from the handler (or from an
+// ISR while it runs) queues one more run, several posts before that are a single run.
+bool EVT_dispatch(void) {
+    uint8_t event_bit;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t pending = evt_pending;
+        event_bit       = pending & -pending;    // Lowest event number first
+        evt_pending     = pending & ~event_bit;
+    }
+    if (event_bit == 0) return false;
+
+    uint8_t event = 0;
+    while (event_bit >>= 1) event++;
+    if (evt_entries[event].handler) evt_entries[event].handler(event, evt_entries[event].ctx);
+    return true;
+}
+
+// The mode is picked after the pending check, both with interrupts off: an EVT_post or a
+// driver releasing its limit in between is seen by the next call. SEI delays interrupts by
+// one instruction, so the wake up interrupt can only come once SLEEP has executed.
+void EVT_idle(void) {
+    cli();
+    if (evt_pending) {
+        sei();
+        return;
+    }
+    EVT_sleep_t sleep = EVT_get_sleep();
+    set_sleep_mode(evt_sleep_modes[sleep]);
+    sleep_enable();
+    if (sleep >= EVT_SLEEP_POWER_SAVE) sleep_bod_disable();    // Only these modes keep it off, BODS lasts 3 cycles
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
+void EVT_run(void) {
+    while (1) {
+        if (!EVT_dispatch()) EVT_idle();
+    }
+}
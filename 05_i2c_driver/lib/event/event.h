@@ -0,0 +1,67 @@
+/**
+ * @file event.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-16
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "../../board.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Event loop: the ISRs (or the driver callbacks they call) only post an event bit, the handlers
+// run in the main loop, lowest event number first. With no event pending the CPU sleeps in
+// the deepest mode that every registered handler, and every active EVT_sleep_limit, tolerates.
+#ifndef EVT_MAX_EVENTS
+#define EVT_MAX_EVENTS 8    // One pending bit per event, up to 8
+#endif
+
+// Lightest to deepest. What keeps running (and can wake the CPU) in each mode:
+//  - IDLE: everything but the CPU, so any interrupt (TIM_0/1, UART, I2C master, pin edges)
+//  - ADC_NOISE_REDUCTION: ADC, TIM_2 asynchronous, I2C address match, INTx level and PCINT
+//  - POWER_SAVE: TIM_2 asynchronous, I2C address match, INTx level and PCINT
+//  - POWER_DOWN: I2C address match, INTx level and PCINT (edge INTx needs the I/O clock: IDLE)
+typedef enum {
+    EVT_SLEEP_IDLE,
+    EVT_SLEEP_ADC_NOISE_REDUCTION,
+    EVT_SLEEP_POWER_SAVE,
+    EVT_SLEEP_POWER_DOWN,
+    EVT_N_SLEEP,
+} EVT_sleep_t;
+
+typedef void (*EVT_handler_t)(uint8_t event, void *ctx);
+
+typedef struct {
+    uint8_t event;    // 0 (highest priority) to EVT_MAX_EVENTS - 1, one handler per event
+    EVT_handler_t handler;
+    void *ctx;
+    EVT_sleep_t deepest_sleep;    // Deepest mode the source of this event can wake the CPU from
+} EVT_init_t;
+
+bool EVT_register(EVT_init_t *cfg);
+void EVT_unregister(uint8_t event);
+
+void EVT_post(uint8_t event);    // ISR safe
+
+// Temporary limit (e.g. while a transfer or a conversion is running), reference counted: every
+// EVT_sleep_limit must be paired with an EVT_sleep_unlimit of the same mode. The I2C transfers,
+// the UART TX and the ADC IT conversions hold their own while busy.
+void EVT_sleep_limit(EVT_sleep_t deepest_sleep);
+void EVT_sleep_unlimit(EVT_sleep_t deepest_sleep);
+EVT_sleep_t EVT_get_sleep(void);    // Mode EVT_idle would use now
+
+bool EVT_dispatch(void);    // Runs the handler of the highest priority pending event, false if none
+void EVT_idle(void);        // Sleeps unless an event is pending
+void EVT_run(void);         // Dispatch/idle loop, never returns
+
+#endif    // EVENT_H
@@ -0,0 +1,163 @@
+/**
+ * @file pt.h
+ * @author Guido Rodriguez (guerodriguez@fi.uba.ar)
+ * @brief
+ * @version 0.1
+ * @date 2025-06-12
+ *
+ * @copyright Copyright (c) 2025. All rights reserved.
+ *
+ * Licensed under the MIT License, see LICENSE for details.
+ * SPDX-License-Identifier: MIT
+ *
+ */
+
+#ifndef PT_H
+#define PT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/atomic.h>
+
+// Stackless coroutines (protothreads): a multi step flow is written as sequential code, but
+// every wait returns to the caller, which calls the thread again later (main loop, scheduler
+// task) to resume it at the same line. The whole state is the 2 byte PT_t, resumed with a
+// switch on __LINE__, so:
+//  - locals do not survive a wait: keep them static or in a context struct
+//  - no switch statement can be used around a wait inside the thread body
+//  - only one wait per source line
+typedef struct {
+    uint16_t lc;    // Line of the last wait, 0 = start
+} PT_t;
+
+typedef enum {
+    PT_WAITING,
+    PT_YIELDED,
+    PT_EXITED,
+    PT_ENDED,
+} PT_state_t;
+
+// Every wait falls through into its own case label on purpose
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define PT_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define PT_FALLTHROUGH
+#endif
+
+#define PT_THREAD(name_args) PT_state_t name_args
+
+#define PT_INIT(pt) ((pt)->lc = 0)
+
+#define PT_BEGIN(pt)            \
+    {                           \
+        bool PT_yielded = true; \
+        (void)PT_yielded;       \
+        switch ((pt)->lc) {     \
+            case 0:
+
+#define PT_END(pt)      \
+    }                   \
+    PT_yielded = false; \
+    (void)PT_yielded;   \
+    PT_INIT(pt);        \
+    return PT_ENDED;    \
+    }
+
+// Still running while true: while (PT_SCHEDULE(thread(&pt))) { ... }
+#define PT_SCHEDULE(f) ((f) < PT_EXITED)
+
+/* Waits -------------------------------------- */
+#define PT_WAIT_UNTIL(pt, condition) \
+    do {                             \
+        (pt)->lc = __LINE__;         \
+        PT_FALLTHROUGH;              \
+        case __LINE__:               \
+            if (!(condition)) {      \
+                return PT_WAITING;   \
+            }                        \
+    } while (0)
+
+#define PT_WAIT_WHILE(pt, condition) PT_WAIT_UNTIL(pt, !(condition))
+
+// Completion flag set by an ISR or a driver callback, cleared when it is taken
+#define PT_WAIT_FLAG(pt, flag) PT_WAIT_UNTIL(pt, PT_flag_take(&(flag)))
+
+// Runs a child protothread to its end, the parent waits meanwhile
+#define PT_WAIT_THREAD(pt, thread) PT_WAIT_WHILE(pt, PT_SCHEDULE(thread))
+
+#define PT_SPAWN(pt, child, thread) \
+    do {                            \
+        PT_INIT(child);             \
+        PT_WAIT_THREAD(pt, thread); \
+    } while (0)
+
+// Gives the caller one turn even when nothing is awaited
+#define PT_YIELD(pt)               \
+    do {                           \
+        PT_yielded = false;        \
+        (pt)->lc   = __LINE__;     \
+        PT_FALLTHROUGH;            \
+        case __LINE__:             \
+            if (!PT_yielded) {     \
+                return PT_YIELDED; \
+            }                      \
+    } while (0)
+
+#define PT_YIELD_UNTIL(pt, condition)          \
+    do {                                       \
+        PT_yielded = false;                    \
+        (pt)->lc   = __LINE__;                 \
+        PT_FALLTHROUGH;                        \
+        case __LINE__:                         \
+            if (!PT_yielded || !(condition)) { \
+                return PT_YIELDED;             \
+            }                                  \
+    } while (0)
+
+#define PT_RESTART(pt)     \
+    do {                   \
+        PT_INIT(pt);       \
+        return PT_WAITING; \
+    } while (0)
+
+#define PT_EXIT(pt)       \
+    do {                  \
+        PT_INIT(pt);      \
+        return PT_EXITED; \
+    } while (0)
+
+static inline __attribute__((always_inline)) bool PT_flag_take(volatile bool *flag) {
+    bool is_set = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        is_set = *flag;
+        *flag  = false;
+    }
+    return is_set;
+}
+
+/* Timers ------------------------------------- */
+// Millisecond clock given by the application (e.g. a TIM CTC tick), only needed by PT_timer_x.
+// It wraps every 65 s: intervals are compared as differences, so the wrap is harmless.
+extern uint16_t PT_clock_ms(void);
+
+typedef struct {
+    uint16_t start;
+    uint16_t interval;
+} PT_timer_t;
+
+static inline void PT_timer_set(PT_timer_t *timer, uint16_t interval_ms) {
+    timer->start    = PT_clock_ms();
+    timer->interval = interval_ms;
+}
+
+static inline bool PT_timer_expired(PT_timer_t *timer) {
+    return (uint16_t)(PT_clock_ms() - timer->start) >= timer->interval;
+}
+
+#define PT_WAIT_MS(pt, timer, interval_ms)          \
+    do {                                            \
+        PT_timer_set(timer, interval_ms);           \
+        PT_WAIT_UNTIL(pt, PT_timer_expired(timer)); \
+    } while (0)
+
+#endif    // PT_H
@@ -1,18 +1,92 @@
 #include "Drivers/gpio/gpio.h"
+#include "Drivers/timer/timer.h"
 #include "Drivers/uart/uart.h"
 #include "board.h"
 #include "lib/ILS94202/ils94202.h"
+#include "lib/event/event.h"
+#include "lib/pt/pt.h"
 #include <avr/interrupt.h>
-#include <util/delay.h>
+#include <util/atomic.h>
 
-static volatile bool is_panic_mode = false;
+#define TICK_PRESET ((F_CPU_HZ / 64 / 1000) - 1)    // 1 ms CTC tick, TIM_0 DIV64
+
+#define BMS_POLL_MS       100U
+#define BMS_POWER_DOWN_MS 5U
+#define LED_TOGGLE_MS     20U
+
+// Event loop priorities (0 first)
+typedef enum {
+    EV_PANIC,
+    EV_TICK,
+} event_t;
+
+static bool is_panic_mode         = false;
+static volatile uint16_t clock_ms = 0;
 
 void GPIO_EXTI_callback(GPIO_port_t port, GPIO_pin_t pin, GPIO_pin_state_t state) {
+    EVT_post(EV_PANIC);
+}
+
+void TIM_CTC_callback(TIM_handle_t *htim) {
+    clock_ms++;
+    EVT_post(EV_TICK);
+}
+
+uint16_t PT_clock_ms(void) {
+    uint16_t now;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now = clock_ms;
+    }
+    return now;
+}
+
+// Polls the BMS until the panic input, then keeps it in power down
+static PT_THREAD(bms_thread(PT_t *pt, ILS94202_handle_t *hbms)) {
+    static PT_t transfer;
+    static PT_timer_t timer;
+
+    PT_BEGIN(pt);
+
+    while (!is_panic_mode) {
+        PT_SPAWN(pt, &transfer, ILS94202_probe_pt(&transfer, hbms));
+        if (ILS94202_get_status(hbms) != I2C_OK) {
+            printf("BMS_NO_ANSWER %u\n", ILS94202_get_status(hbms));
+        }
+        PT_timer_set(&timer, BMS_POLL_MS);
+        PT_WAIT_UNTIL(pt, is_panic_mode || PT_timer_expired(&timer));
+    }
+
+    // TODO: Apagar otros periféricos
+    while (1) {
+        PT_SPAWN(pt, &transfer, ILS94202_set_power_down_mode_pt(&transfer, hbms));
+        PT_WAIT_MS(pt, &timer, BMS_POWER_DOWN_MS);
+    }
+
+    PT_END(pt);
+}
+
+static PT_THREAD(led_thread(PT_t *pt)) {
+    static PT_timer_t timer;
+
+    PT_BEGIN(pt);
+
+    while (!is_panic_mode) {
+        GPIO_toggle_pin(GPIO_PORTB, GPIO_0);
+        PT_WAIT_MS(pt, &timer, LED_TOGGLE_MS);
+    }
+
+    PT_END(pt);
+}
+
+static PT_t bms_pt, led_pt;
+
+void panic_handler(uint8_t event, void *ctx) {
     is_panic_mode = true;
 }
 
-void delay(uint8_t time_ms) {
-    while (time_ms--) _delay_ms(1);
+void tick_handler(uint8_t event, void *ctx) {
+    bms_thread(&bms_pt, (ILS94202_handle_t *)ctx);
+    led_thread(&led_pt);
 }
 
 int main(void) {
@@ -35,24 +109,26 @@ int main(void) {
     ILS94202_handle_t *hbms = ILS94202_init(&bms_cfg);
     printf("BMS_INIT_OK\n");
 
-    sei();
-
-    while (1) {
-        if (is_panic_mode) {
-            cli();
+    TIM_init_t tick_cfg = {
+        .timer        = TIM_0,
+        .clk_source   = TIM_CLK_INTERNAL_PRESCALER_DIV64,
+        .preset_value = TICK_PRESET,
+        .mode         = CTC_CHANNEL_A_NO_OUTPUT,
+    };
+    TIM_handle_t *htick = TIM_CTC_init(&tick_cfg);
+    TIM_CTC_A_start_IT(htick);
 
-            // TODO: Apagar otros periféricos
+    PT_INIT(&bms_pt);
+    PT_INIT(&led_pt);
 
-            while (1) {
-                ILS94202_set_power_down_mode(hbms);
-                _delay_ms(5);
-            }
+    // Both sources need the I/O clock (edge INT0, TIM_0), so the loop sleeps in IDLE
+    EVT_init_t panic_event_cfg = {.event = EV_PANIC, .handler = panic_handler, .deepest_sleep = EVT_SLEEP_IDLE};
+    EVT_init_t tick_event_cfg  = {.event = EV_TICK, .handler = tick_handler, .ctx = hbms, .deepest_sleep = EVT_SLEEP_IDLE};
+    EVT_register(&panic_event_cfg);
+    EVT_register(&tick_event_cfg);
 
-        } else {
-            GPIO_toggle_pin(GPIO_PORTB, GPIO_0);
-            _delay_ms(20);    // NOTE: No usar delay en firmware final
-        }
-    }
+    sei();
+    EVT_run();    // Every wait of the threads, the I2C steps too, is polled once per tick
 
     return 0;
 }